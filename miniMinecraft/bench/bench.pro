@@ -0,0 +1,36 @@
+# Times the terrain code and checks its faster paths against the slower
+# ones, apart from the game: qmake bench/bench.pro && make && ./TerrainBench
+QT += core widgets openglwidgets
+
+TARGET = TerrainBench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++1z
+CONFIG += warn_on
+win32 {
+    LIBS += -lopengl32
+}
+
+INCLUDEPATH += ../include
+
+include(../src/core.pri)
+
+SOURCES += \
+    main.cpp \
+    terrainbench.cpp
+
+HEADERS += \
+    terrainbench.h
+
+# make check runs only the benchmarks that compare results, and fails
+# when any of them finds a difference
+check.commands = ./$$TARGET sampleterrain remesh regions
+check.depends = $$TARGET
+QMAKE_EXTRA_TARGETS += check
+
+*-clang*|*-g++* {
+    CONFIG -= warn_on
+    QMAKE_CXXFLAGS += -Wall -Wextra -pedantic -Winit-self
+    QMAKE_CXXFLAGS += -Wno-strict-aliasing
+}
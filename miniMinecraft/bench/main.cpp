@@ -0,0 +1,44 @@
+#include "terrainbench.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Runs the benchmarks named on the command line, or all of them, on the
+// terrain generation zone at the origin. Exits with 1 when a benchmark
+// finds results that should have matched and did not.
+int main(int argc, char *argv[])
+{
+    const char *names[] = {"meshing", "remesh", "memory", "noise", "sampleterrain",
+                           "caves", "jobs", "regions", "saving"};
+    auto selected = [&](const char *name) {
+        if (argc < 2) return true;
+        for (int i = 1; i < argc; i++) {
+            if (std::strcmp(argv[i], name) == 0) return true;
+        }
+        return false;
+    };
+    for (int i = 1; i < argc; i++) {
+        if (std::find_if(std::begin(names), std::end(names), [&](const char *name) {
+                return std::strcmp(argv[i], name) == 0; }) == std::end(names)) {
+            std::cerr << "unknown benchmark " << argv[i] << ", expected one of:";
+            for (const char *name : names) std::cerr << " " << name;
+            std::cerr << std::endl;
+            return 2;
+        }
+    }
+
+    TerrainBench bench(glm::ivec2(0, 0));
+    bool passed = true;
+    if (selected("meshing")) bench.benchmarkMeshing();
+    if (selected("remesh")) passed &= bench.benchmarkRemesh();
+    if (selected("memory")) bench.reportBlockMemory();
+    if (selected("noise")) bench.benchmarkNoise();
+    if (selected("sampleterrain")) passed &= bench.checkSampleTerrain();
+    if (selected("caves")) bench.benchmarkCaves();
+    if (selected("jobs")) bench.benchmarkJobs();
+    if (selected("regions")) passed &= bench.benchmarkRegions();
+    if (selected("saving")) passed &= bench.stressTestSaving();
+
+    return passed ? 0 : 1;
+}
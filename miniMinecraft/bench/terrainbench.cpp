@@ -0,0 +1,439 @@
+#include "terrainbench.h"
+#include "biome.h"
+#include "noisebatch.h"
+#include "scene/chunkview.h"
+#include "scene/regionfile.h"
+#include "scene/FBMWorker.h"
+#include "scene/VBOWorker.h"
+#include "scene/SaveWorker.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <QDir>
+#include <QElapsedTimer>
+
+// Where benchmarkRegions and stressTestSaving write their region files,
+// away from the game's saves/world
+const char *BENCHMARK_DIRECTORY = "saves/world-benchmark";
+const char *STRESS_DIRECTORY = "saves/world-stress";
+
+TerrainBench::TerrainBench(glm::ivec2 zone)
+    : m_zone(zone)
+{}
+
+std::vector<uPtr<Chunk>> TerrainBench::makeGrid(glm::ivec2 origin, int side) {
+    std::vector<uPtr<Chunk>> chunks;
+    for (int i = 0; i < side * side; i++) {
+        chunks.push_back(mkU<Chunk>(nullptr, origin.x + 16 * (i % side),
+                                    origin.y + 16 * (i / side)));
+    }
+    for (int i = 0; i < side * side; i++) {
+        if (i % side > 0) chunks[i]->linkNeighbor(chunks[i - 1], XNEG);
+        if (i / side > 0) chunks[i]->linkNeighbor(chunks[i - side], ZNEG);
+    }
+    return chunks;
+}
+
+void TerrainBench::generateGrid(std::vector<uPtr<Chunk>> &chunks, int side, JobSystem &jobs) {
+    for (uPtr<Chunk> &c : chunks) {
+        jobs.submit(GENERATE_JOB, mkU<FBMWorker>(c.get(), BASE_TERRAIN, &jobs));
+    }
+    jobs.waitForIdle();
+    // Decorating touches the neighbors, so only Chunks at least three
+    // apart are decorated at once, in nine rounds
+    for (int round = 0; round < 9; round++) {
+        for (int i = 0; i < side * side; i++) {
+            if ((i % side) % 3 == round % 3 && (i / side) % 3 == round / 3) {
+                jobs.submit(DECORATE_JOB, mkU<FBMWorker>(chunks[i].get(), DECORATED, &jobs));
+            }
+        }
+        jobs.waitForIdle();
+    }
+    jobs.takeCompleted();
+}
+
+void TerrainBench::benchmarkMeshing() {
+    const int side = 12;
+    std::vector<uPtr<Chunk>> chunks = makeGrid(m_zone - glm::ivec2(64), side);
+    JobSystem jobs(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1));
+    generateGrid(chunks, side, jobs);
+
+    for (MeshingMode mode : {PER_FACE, GREEDY}) {
+        ChunkMesh mesh;
+        size_t vertices = 0;
+        qint64 nsecs = 0;
+        for (uPtr<Chunk> &c : chunks) {
+            QElapsedTimer timer;
+            timer.start();
+            c->buildMesh(ChunkView(c.get()), mode, mesh);
+            nsecs += timer.nsecsElapsed();
+            vertices += mesh.vertexCount();
+        }
+
+        std::cout << (mode == GREEDY ? "greedy:   " : "per-face: ")
+                  << chunks.size() << " chunks, "
+                  << vertices / chunks.size() << " vertices/chunk, "
+                  << nsecs / chunks.size() / 1000.0 << " us/chunk" << std::endl;
+    }
+}
+
+bool TerrainBench::benchmarkRemesh() {
+    const int EDITS = 256;
+
+    std::vector<uPtr<Chunk>> chunks;
+    for (int x = m_zone.x; x < m_zone.x + 64; x += 16) {
+        for (int z = m_zone.y; z < m_zone.y + 64; z += 16) {
+            chunks.push_back(mkU<Chunk>(nullptr, x, z));
+            chunks.back()->generateChunk(x, z);
+            chunks.back()->createVBOdata();
+        }
+    }
+
+    std::mt19937 rng(21);
+    ChunkMesh rebuilt;
+    qint64 patchNsecs = 0, rebuildNsecs = 0;
+    int mismatches = 0;
+    for (int i = 0; i < EDITS; i++) {
+        Chunk *c = chunks[rng() % chunks.size()].get();
+        unsigned int x = rng() % 16, z = rng() % 16;
+        // Break the top block of the column or place one on it,
+        // which is where the player edits
+        unsigned int y = 255;
+        while (y > 0 && c->getBlockAt(x, y, z) == EMPTY) y--;
+        BlockType t = EMPTY;
+        if (i % 2 == 0 && y < 255) {
+            y++;
+            t = STONE;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        c->setBlockAt(x, y, z, t);
+        int sy = y / 16;
+        c->remeshSection(sy);
+        if (y % 16 == 0 && sy > 0) c->remeshSection(sy - 1);
+        if (y % 16 == 15 && sy < 15) c->remeshSection(sy + 1);
+        patchNsecs += timer.nsecsElapsed();
+
+        timer.restart();
+        c->buildMesh(ChunkView(c), Chunk::meshingMode(), rebuilt);
+        rebuildNsecs += timer.nsecsElapsed();
+
+        // The quads of every section must be the same, spare slots aside
+        const ChunkMesh &patched = c->mesh();
+        auto sameQuads = [](const std::vector<Vertex> &a, const SectionSlots &sa,
+                            const std::vector<Vertex> &b, const SectionSlots &sb) {
+            return sa.count == sb.count
+                && std::equal(a.begin() + 4 * sa.first, a.begin() + 4 * (sa.first + sa.count),
+                              b.begin() + 4 * sb.first,
+                              [](const Vertex &u, const Vertex &v) { return u.data == v.data; });
+        };
+        for (int s = 0; s < 16; s++) {
+            if (!sameQuads(patched.vboOpaque, patched.opaqueSlots[s], rebuilt.vboOpaque, rebuilt.opaqueSlots[s])
+                || !sameQuads(patched.vboTransparent, patched.transparentSlots[s],
+                              rebuilt.vboTransparent, rebuilt.transparentSlots[s])) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+
+    std::cout << "single block edits: patch " << patchNsecs / EDITS / 1000.0 << " us/edit, "
+              << "rebuild " << rebuildNsecs / EDITS / 1000.0 << " us/edit, "
+              << mismatches << " of " << EDITS << " patched meshes differ" << std::endl;
+    return mismatches == 0;
+}
+
+void TerrainBench::reportBlockMemory() {
+    const int side = 12;
+    std::vector<uPtr<Chunk>> chunks = makeGrid(m_zone - glm::ivec2(64), side);
+    JobSystem jobs(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1));
+    generateGrid(chunks, side, jobs);
+
+    size_t paletteBytes = 0;
+    for (uPtr<Chunk> &c : chunks) {
+        paletteBytes += c->blockMemoryUsage();
+    }
+
+    size_t flatBytes = chunks.size() * sizeof(std::array<BlockType, 65536>);
+    std::cout << chunks.size() << " chunks: flat array " << flatBytes / 1024 << " KiB, "
+              << "palette " << paletteBytes / 1024 << " KiB ("
+              << 100.0 * paletteBytes / flatBytes << "%)" << std::endl;
+}
+
+void TerrainBench::benchmarkNoise() {
+    // Keeps the compiler from dropping the batched heights
+    float checksum = 0.f;
+    int mismatches = 0;
+    qint64 referenceNsecs = 0, fusedNsecs = 0, scalarNsecs = 0, batchNsecs = 0;
+    std::array<glm::vec3, 16 * 16> reference;
+    TerrainHeightsBatch heights;
+    for (int x = m_zone.x; x < m_zone.x + 64; x += 16) {
+        for (int z = m_zone.y; z < m_zone.y + 64; z += 16) {
+            QElapsedTimer timer;
+            timer.start();
+            for (int i = 0; i < 16 * 16; i++) {
+                glm::vec2 xz(x + i % 16, z + i / 16);
+                reference[i] = glm::vec3(peakHeight(xz), midHeight(xz), lowHeight(xz));
+            }
+            referenceNsecs += timer.nsecsElapsed();
+
+            timer.restart();
+            for (int i = 0; i < 16 * 16; i++) {
+                TerrainSample sample = sampleTerrain(glm::vec2(x + i % 16, z + i / 16));
+                if (glm::vec3(sample.peak, sample.mid, sample.low) != reference[i]) {
+                    mismatches++;
+                }
+            }
+            fusedNsecs += timer.nsecsElapsed();
+
+            timer.restart();
+            terrainHeightsBatchScalar(glm::ivec2(x, z), heights);
+            scalarNsecs += timer.nsecsElapsed();
+
+            timer.restart();
+            terrainHeightsBatch(glm::ivec2(x, z), heights);
+            batchNsecs += timer.nsecsElapsed();
+            checksum += heights.mid[0];
+        }
+    }
+
+    std::cout << "terrain heights per chunk: reference " << referenceNsecs / 16 / 1000.0 << " us, "
+              << "sampleTerrain " << fusedNsecs / 16 / 1000.0 << " us "
+              << "(" << mismatches << " columns differ), "
+              << "batch scalar " << scalarNsecs / 16 / 1000.0 << " us, "
+              << "batch " << noiseBatchInstructionSet() << " " << batchNsecs / 16 / 1000.0 << " us"
+              << " (checksum " << checksum << ")" << std::endl;
+}
+
+bool TerrainBench::checkSampleTerrain() {
+    // Every 17th column from -2048 to 2048 on both axes, so the grid
+    // crosses the lattices of every noise octave at different offsets
+    const int EXTENT = 2048, STEP = 17;
+    auto sameBits = [](float a, float b) {
+        return std::memcmp(&a, &b, sizeof(float)) == 0;
+    };
+
+    size_t columns = 0, mismatches = 0;
+    for (int x = -EXTENT; x < EXTENT; x += STEP) {
+        for (int z = -EXTENT; z < EXTENT; z += STEP) {
+            glm::vec2 xz(x, z);
+            TerrainSample sample = sampleTerrain(xz);
+            float peak = peakHeight(xz), mid = midHeight(xz), low = lowHeight(xz);
+            columns++;
+            if (sameBits(sample.peak, peak) && sameBits(sample.mid, mid) && sameBits(sample.low, low)) {
+                continue;
+            }
+            if (mismatches++ == 0) {
+                std::cout << std::setprecision(9) << "sampleTerrain differs at (" << x << ", " << z << "): "
+                          << sample.peak << " " << sample.mid << " " << sample.low << " against "
+                          << peak << " " << mid << " " << low << std::endl;
+            }
+        }
+    }
+
+    std::cout << "sampleTerrain: " << mismatches << " of " << columns
+              << " columns differ from peakHeight, midHeight and lowHeight" << std::endl;
+    return mismatches == 0;
+}
+
+void TerrainBench::benchmarkCaves() {
+    qint64 exactNsecs = 0, trilinearNsecs = 0;
+    size_t mismatches = 0;
+    for (int x = m_zone.x; x < m_zone.x + 64; x += 16) {
+        for (int z = m_zone.y; z < m_zone.y + 64; z += 16) {
+            Chunk exact(nullptr, x, z), trilinear(nullptr, x, z);
+            QElapsedTimer timer;
+            timer.start();
+            exact.generateChunk(x, z, CAVES_EXACT);
+            exactNsecs += timer.nsecsElapsed();
+
+            timer.restart();
+            trilinear.generateChunk(x, z, CAVES_TRILINEAR);
+            trilinearNsecs += timer.nsecsElapsed();
+
+            for (unsigned int y = 0; y < 256; y++) {
+                for (unsigned int bz = 0; bz < 16; bz++) {
+                    for (unsigned int bx = 0; bx < 16; bx++) {
+                        if (exact.getBlockAt(bx, y, bz) != trilinear.getBlockAt(bx, y, bz)) {
+                            mismatches++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "chunk generation: exact caves " << exactNsecs / 16 / 1000.0 << " us/chunk, "
+              << "trilinear caves " << trilinearNsecs / 16 / 1000.0 << " us/chunk, "
+              << mismatches << " of " << 16 * 16 * 256 * 16 << " blocks differ" << std::endl;
+}
+
+void TerrainBench::benchmarkJobs() {
+    const int side = 8;
+
+    int maxWorkers = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    for (int workers = 1; ; workers = std::min(workers * 2, maxWorkers)) {
+        std::vector<uPtr<Chunk>> chunks = makeGrid(m_zone, side);
+
+        JobSystem jobs(workers);
+        QElapsedTimer timer;
+        timer.start();
+        generateGrid(chunks, side, jobs);
+        qint64 generateNsecs = timer.nsecsElapsed();
+
+        timer.restart();
+        for (uPtr<Chunk> &c : chunks) {
+            jobs.submit(MESH_JOB, mkU<VBOWorker>(c.get(), ChunkView(c.get()), &jobs));
+        }
+        jobs.waitForIdle();
+        qint64 meshNsecs = timer.nsecsElapsed();
+
+        std::cout << workers << " workers: generated "
+                  << chunks.size() * 1e9 / generateNsecs << " chunks/s, meshed "
+                  << chunks.size() * 1e9 / meshNsecs << " chunks/s" << std::endl;
+        if (workers == maxWorkers) break;
+    }
+}
+
+bool TerrainBench::benchmarkRegions() {
+    qint64 generateNsecs = 0, saveNsecs = 0, loadNsecs = 0;
+    size_t mismatches = 0;
+    {
+        RegionStore store(BENCHMARK_DIRECTORY);
+        std::vector<uPtr<Chunk>> generated, loaded;
+        for (int x = m_zone.x; x < m_zone.x + 64; x += 16) {
+            for (int z = m_zone.y; z < m_zone.y + 64; z += 16) {
+                generated.push_back(mkU<Chunk>(nullptr, x, z));
+                loaded.push_back(mkU<Chunk>(nullptr, x, z));
+            }
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        for (uPtr<Chunk> &c : generated) {
+            c->generateChunk(c->minX, c->minZ);
+        }
+        generateNsecs = timer.nsecsElapsed();
+
+        timer.restart();
+        for (uPtr<Chunk> &c : generated) {
+            store.queue(c->snapshot());
+        }
+        store.flush();
+        saveNsecs = timer.nsecsElapsed();
+
+        timer.restart();
+        for (uPtr<Chunk> &c : loaded) {
+            store.load(c.get());
+        }
+        loadNsecs = timer.nsecsElapsed();
+
+        for (size_t i = 0; i < generated.size(); i++) {
+            for (unsigned int y = 0; y < 256; y++) {
+                for (unsigned int bz = 0; bz < 16; bz++) {
+                    for (unsigned int bx = 0; bx < 16; bx++) {
+                        if (generated[i]->getBlockAt(bx, y, bz) != loaded[i]->getBlockAt(bx, y, bz)) {
+                            mismatches++;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::cout << "chunk regions: generate " << generateNsecs / 16 / 1000.0 << " us/chunk, "
+                  << "save " << saveNsecs / 16 / 1000.0 << " us/chunk, "
+                  << "load " << loadNsecs / 16 / 1000.0 << " us/chunk, "
+                  << store.diskUsage() / 1024.0 << " KiB on disk for 16 chunks "
+                  << "(" << 16 * 64 << " KiB as flat arrays), "
+                  << mismatches << " blocks differ after loading" << std::endl;
+    }
+    QDir(BENCHMARK_DIRECTORY).removeRecursively();
+    return mismatches == 0;
+}
+
+bool TerrainBench::stressTestSaving() {
+    const BlockType types[] = {EMPTY, STONE, DIRT, OAK_LOG, OAK_LEAF, SAND, WATER};
+
+    size_t mismatches = 0;
+    {
+        RegionStore store(STRESS_DIRECTORY);
+        JobSystem jobs(1);
+        std::vector<uPtr<Chunk>> chunks;
+        for (int x = m_zone.x; x < m_zone.x + 64; x += 16) {
+            for (int z = m_zone.y; z < m_zone.y + 64; z += 16) {
+                chunks.push_back(mkU<Chunk>(nullptr, x, z));
+                chunks.back()->generateChunk(x, z);
+            }
+        }
+
+        std::mt19937 rng(20);
+        size_t frames = 0, edits = 0, snapshots = 0, flushes = 0;
+        qint64 saveNsecs = 0, maxSaveNsecs = 0;
+        bool saving = false;
+        QElapsedTimer elapsed;
+        elapsed.start();
+        while (elapsed.elapsed() < 3000) {
+            for (int i = 0; i < 256; i++, edits++) {
+                chunks[rng() % chunks.size()]->setBlockAt(rng() % 16, rng() % 256, rng() % 16,
+                                                          types[rng() % 7]);
+            }
+
+            // What autosave does every frame, without the interval
+            QElapsedTimer timer;
+            timer.start();
+            for (JobCompletion &done : jobs.takeCompleted()) {
+                if (done.type == SAVE_JOB) saving = false;
+            }
+            if (!saving) {
+                for (uPtr<Chunk> &c : chunks) {
+                    if (!c->isDirty()) continue;
+                    std::shared_ptr<const Chunk::Snapshot> snapshot = c->snapshot();
+                    c->markSaved(snapshot->generation);
+                    store.queue(std::move(snapshot));
+                    snapshots++;
+                }
+                jobs.submit(SAVE_JOB, mkU<SaveWorker>(&store, &jobs));
+                saving = true;
+                flushes++;
+            }
+            qint64 nsecs = timer.nsecsElapsed();
+            saveNsecs += nsecs;
+            maxSaveNsecs = std::max(maxSaveNsecs, nsecs);
+            frames++;
+        }
+        jobs.waitForIdle();
+        for (uPtr<Chunk> &c : chunks) {
+            if (c->isDirty()) store.queue(c->snapshot());
+        }
+        store.flush();
+
+        for (uPtr<Chunk> &c : chunks) {
+            Chunk loaded(nullptr, c->minX, c->minZ);
+            store.load(&loaded);
+            for (unsigned int y = 0; y < 256; y++) {
+                for (unsigned int bz = 0; bz < 16; bz++) {
+                    for (unsigned int bx = 0; bx < 16; bx++) {
+                        if (c->getBlockAt(bx, y, bz) != loaded.getBlockAt(bx, y, bz)) {
+                            mismatches++;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::cout << "save stress: " << edits << " edits in " << frames << " frames, "
+                  << snapshots << " snapshots in " << flushes << " flushes, "
+                  << store.recordsWritten() << " records written, "
+                  << "main thread " << saveNsecs / frames / 1000.0 << " us/frame (max "
+                  << maxSaveNsecs / 1000.0 << " us), "
+                  << mismatches << " blocks differ after loading" << std::endl;
+    }
+    QDir(STRESS_DIRECTORY).removeRecursively();
+    return mismatches == 0;
+}
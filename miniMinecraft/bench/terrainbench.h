@@ -0,0 +1,61 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "glm_includes.h"
+#include "scene/chunk.h"
+#include "scene/jobsystem.h"
+#include <vector>
+
+// Times the terrain code and checks that its faster paths give the same
+// results as the slower ones, apart from the game. Every Chunk is generated
+// apart from any world and never uploaded, so no OpenGL context is needed.
+// The benchmarks that compare results return whether they all matched.
+class TerrainBench {
+private:
+    // The lower-left corner of the terrain generation zone benchmarked
+    glm::ivec2 m_zone;
+
+    // side x side Chunks with their lower-left corner at origin, linked
+    // to their neighbors and not generated yet
+    static std::vector<uPtr<Chunk>> makeGrid(glm::ivec2 origin, int side);
+    // Runs both generation passes on a grid from makeGrid, decorating only
+    // Chunks at least three apart at once as the scheduler does
+    static void generateGrid(std::vector<uPtr<Chunk>> &chunks, int side, JobSystem &jobs);
+
+public:
+    TerrainBench(glm::ivec2 zone);
+
+    // Meshes the Chunks of the 3 x 3 zones around the zone with each
+    // mesher and prints the vertex count and build time
+    void benchmarkMeshing();
+    // Makes random single block edits to the 16 Chunks of the zone and
+    // prints the time to patch the mesh against rebuilding it, and how
+    // many patched meshes differ from rebuilt ones
+    bool benchmarkRemesh();
+    // Prints the memory used by the blocks of the Chunks of the 3 x 3
+    // zones around the zone, compared to a flat 64 KiB array each
+    void reportBlockMemory();
+    // Times the terrain heights of the 16 Chunks of the zone computed by
+    // peakHeight, midHeight and lowHeight against sampleTerrain and the
+    // batched noise kernels, and counts the columns where sampleTerrain differs
+    void benchmarkNoise();
+    // Compares the heights sampleTerrain derives against peakHeight,
+    // midHeight and lowHeight bit for bit, over a fixed grid of columns
+    // both sides of the origin, and prints the first column that differs
+    bool checkSampleTerrain();
+    // Generates the 16 Chunks of the zone with exact and with trilinear
+    // cave noise, and prints the generation time of each and how many
+    // blocks differ between them
+    void benchmarkCaves();
+    // Generates and meshes 64 Chunks with 1, 2, 4, ... up to one worker
+    // thread per core and prints the Chunks per second
+    void benchmarkJobs();
+    // Saves the 16 Chunks of the zone to region files of their own and
+    // loads them back, and prints the time per Chunk of generating against
+    // loading, and the bytes a record takes
+    bool benchmarkRegions();
+    // Edits blocks of the 16 Chunks of the zone as fast as it can for a few
+    // seconds while saving them in the background as autosave does, then
+    // loads them back and prints how many blocks differ and how long the
+    // main thread spent saving
+    bool stressTestSaving();
+};
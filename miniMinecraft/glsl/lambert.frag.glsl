@@ -22,6 +22,7 @@ uniform int u_Time;
 in vec3 fs_Nor;
 in vec3 fs_LightVec;
 in vec2 fs_UV;
+in vec3 fs_Pos;
 
 out vec4 out_Col; // This is the final output color that you will see on your
                   // screen for the pixel that is currently being processed.
@@ -33,18 +34,34 @@ const vec3 sun[3] = vec3[](vec3(255, 255, 190) / 255.0,
                            vec3(255, 140, 100) / 255.0,
                            vec3(200, 140, 100) / 255.0);
 
+// A face may span several blocks, so the position inside the block
+// is read off the world position and mapped onto the face's tile.
+vec2 tileUV(vec3 pos, vec3 nor)
+{
+    vec3 f = fract(pos);
+    if (nor.x > 0.5)  return vec2(1.0 - f.z, f.y);
+    if (nor.x < -0.5) return vec2(f.z, f.y);
+    if (nor.y > 0.5)  return vec2(f.x, 1.0 - f.z);
+    if (nor.y < -0.5) return vec2(f.x, f.z);
+    if (nor.z > 0.5)  return vec2(f.x, f.y);
+    return vec2(1.0 - f.x, f.y);
+}
+
 void main()
 {
-    vec2 uv = fs_UV;
+    // fs_UV is the same at every vertex of a face; snap it back onto
+    // the atlas grid in case interpolation nudged it off
+    vec2 tile = floor(fs_UV * 16.0 + 0.5) / 16.0;
+    vec2 uv = tile + tileUV(fs_Pos, fs_Nor) / 16.0;
     // animation for WATER and LAVA
     float wave = sin(float(u_Time) / 1000.0) * 0.01;
     // WATER
-    if (fs_UV.x >= 14.0/16.0 && fs_UV.x < 15.0/16.0 && fs_UV.y >= 3.0/16.0 && fs_UV.y < 4.0/16.0) {
-        uv.x = fs_UV.x + wave;
+    if (tile.x >= 14.0/16.0 && tile.x < 15.0/16.0 && tile.y >= 3.0/16.0 && tile.y < 4.0/16.0) {
+        uv.x = uv.x + wave;
     }
     // LAVA
-    if (fs_UV.x >= 14.0/16.0 && fs_UV.x < 15.0/16.0 && fs_UV.y >= 1.0/16.0 && fs_UV.y < 2.0/16.0) {
-        uv.x = fs_UV.x + wave;
+    if (tile.x >= 14.0/16.0 && tile.x < 15.0/16.0 && tile.y >= 1.0/16.0 && tile.y < 2.0/16.0) {
+        uv.x = uv.x + wave;
     }
 
     float time = sin(u_Time * TIME_SCALE * 0.01 + 0.001);
@@ -17,23 +17,43 @@ uniform mat4 u_ModelInvTr;  // The inverse transpose of the model matrix.
 uniform mat4 u_ViewProj;    // The matrix that defines the camera's transformation.
                             // We've written a static matrix for you to use for HW2,
                             // but in HW3 you'll have to generate one yourself
+uniform isampler2D u_PageOrigins; // The world x and z of the corner of the Chunk each
+                                  // page of 256 vertices of the terrain arena belongs to,
+                                  // which its packed vertex positions are relative to.
+                                  // Pages are laid out in rows of 1024, see TerrainArena.
 
-in vec3 vs_Pos;             // The array of vertex positions passed to the shader
-in vec3 vs_Nor;             // The array of vertex normals passed to the shader
-in vec2 vs_UV;              // The array of vertex texture coordinates passed to the shader
+in uint vs_Data;            // The packed chunk vertex, see Vertex in chunk.h:
+                            // x (5 bits), y (9 bits), z (5 bits), face (3 bits), tile (8 bits)
 
 out vec3 fs_Nor;            // The array of normals that has been transformed by u_ModelInvTr. This is implicitly passed to the fragment shader.
 out vec3 fs_LightVec;       // The direction in which our virtual light lies, relative to each vertex. This is implicitly passed to the fragment shader.
 out vec2 fs_UV;             // The UV of each vertex. This is implicitly passed to the fragment shader.
+out vec3 fs_Pos;            // The world position of each vertex, used to tile the texture across merged faces.
 
 const vec3 lightDir = normalize(vec3(0.5, 1, 0.75));  // The direction of our virtual light, which is used to compute the shading of
                                         // the geometry in the fragment shader.
 
+// The normal of each face, in the order of the Direction enum
+const vec3 faceNormals[6] = vec3[](vec3( 1, 0, 0), vec3(-1, 0, 0),
+                                   vec3( 0, 1, 0), vec3( 0,-1, 0),
+                                   vec3( 0, 0, 1), vec3( 0, 0,-1));
+
 void main()
 {
-    fs_UV = vs_UV;    // Pass the vertex UVs to the fragment shader for interpolation
+    vec3 localPos = vec3(float(vs_Data & 31u),
+                         float((vs_Data >> 5u) & 511u),
+                         float((vs_Data >> 14u) & 31u));
+    vec3 nor = faceNormals[(vs_Data >> 19u) & 7u];
+    uint tile = (vs_Data >> 22u) & 255u;
+
+    fs_UV = vec2(float(tile & 15u), float(tile >> 4u)) / 16.0;    // Pass the tile origin to the fragment shader
+
+    // gl_VertexID includes the base vertex of the Chunk's draw
+    int page = gl_VertexID >> 8;
+    ivec2 origin = texelFetch(u_PageOrigins, ivec2(page & 1023, page >> 10), 0).xy;
+    fs_Pos = vec3(float(origin.x), 0.0, float(origin.y)) + localPos;
 
-    vec3 pos = vs_Pos;
+    vec3 pos = fs_Pos;
     // WATER
     if (fs_UV.x >= 14.0/16.0 && fs_UV.x <= 15.0/16.0 && fs_UV.y >= 3.0/16.0 && fs_UV.y <= 4.0/16.0) {
         pos.y -= 0.1;
@@ -44,7 +64,7 @@ void main()
     }
 
     mat3 invTranspose = mat3(u_ModelInvTr);
-    fs_Nor = invTranspose * vs_Nor;          // Pass the vertex normals to the fragment shader for interpolation.
+    fs_Nor = invTranspose * nor;             // Pass the vertex normals to the fragment shader for interpolation.
                                                             // Transform the geometry's normals by the inverse transpose of the
                                                             // model matrix. This is necessary to ensure the normals remain
                                                             // perpendicular to the surface after the surface is transformed by
@@ -270,3 +270,106 @@ float lowHeight(glm::vec2 xz) {
     return h;
 }
 
+TerrainSample sampleTerrain(glm::vec2 xz) {
+    TerrainSample s;
+
+    s.weirdness = SimplexNoise(randomizeUV(xz, 0.25f, 200.f));
+    s.weirdness = s.weirdness * 0.5f + 0.5f;
+    s.weirdness = glm::smoothstep(0.05f, 0.75f, s.weirdness);
+
+    s.humidity = SimplexNoise(randomizeUV(xz, 0.33f, 128.f));
+    s.humidity = s.humidity * 0.5f + 0.5f;
+    s.humidity = glm::smoothstep(0.1f, 0.8f, s.humidity);
+
+    // The three height functions recompute this offset for every
+    // octave, but it does not depend on the octave
+    glm::vec2 offset = glm::vec2(fbm(xz / 256.0f), fbm(xz / 300.0f) + 1000.0f);
+    float h = 0.0f;
+    float amp = 0.5f;
+    float freq = 128.0f;
+    for(int i = 0; i < 4; ++i) {
+        float h1 = PerlinNoise((xz + offset * 75.0f) / freq);
+        h += h1 * amp;
+        amp *= 0.5f;
+        freq *= 2.0f;
+    }
+
+    float peak = (h + 1.f) * 0.5f;
+    peak = glm::smoothstep(0.f, 0.75f, peak);
+    s.peak = glm::floor(15.f + peak * peak * 100.0f);
+    s.mid = glm::floor(15.f + h * 75.0f);
+    s.low = glm::floor(15.f + h * 50.0f);
+    return s;
+}
+
+// The lattice spans 16 blocks on x and z and CAVE_MAX_Y blocks on y,
+// with one more point at the far end of each
+const int CAVE_LATTICE_XZ = 16 / CAVE_LATTICE_STEP + 1;
+const int CAVE_LATTICE_Y = CAVE_MAX_Y / CAVE_LATTICE_STEP + 1;
+
+CaveNoise::CaveNoise(glm::ivec2 origin, CaveSampling sampling)
+    : m_origin(origin), m_sampling(sampling), m_lattice()
+{
+    if (sampling == CAVES_EXACT) return;
+
+    m_lattice.resize(CAVE_LATTICE_XZ * CAVE_LATTICE_XZ * CAVE_LATTICE_Y);
+    for (int y = 0; y < CAVE_LATTICE_Y; y++) {
+        for (int z = 0; z < CAVE_LATTICE_XZ; z++) {
+            for (int x = 0; x < CAVE_LATTICE_XZ; x++) {
+                glm::vec3 pos(origin.x + x * CAVE_LATTICE_STEP, y * CAVE_LATTICE_STEP,
+                              origin.y + z * CAVE_LATTICE_STEP);
+                m_lattice[x + CAVE_LATTICE_XZ * (z + CAVE_LATTICE_XZ * y)] = SimplexNoise(pos / 32.f);
+            }
+        }
+    }
+}
+
+float CaveNoise::at(int x, int y, int z) const {
+    if (m_sampling == CAVES_EXACT) {
+        glm::vec3 pos(m_origin.x + x, y, m_origin.y + z);
+        return SimplexNoise(pos / 32.f);
+    }
+
+    // The lattice cell holding the block, and where in it the block is.
+    // Blocks on the top layer use the cell below with t = 1.
+    int lx = x / CAVE_LATTICE_STEP;
+    int ly = glm::min(y / CAVE_LATTICE_STEP, CAVE_LATTICE_Y - 2);
+    int lz = z / CAVE_LATTICE_STEP;
+    glm::vec3 t = glm::vec3(x - lx * CAVE_LATTICE_STEP,
+                            y - ly * CAVE_LATTICE_STEP,
+                            z - lz * CAVE_LATTICE_STEP) / float(CAVE_LATTICE_STEP);
+
+    auto lattice = [&](int dx, int dy, int dz) {
+        return m_lattice[(lx + dx) + CAVE_LATTICE_XZ * ((lz + dz) + CAVE_LATTICE_XZ * (ly + dy))];
+    };
+    float x00 = glm::mix(lattice(0, 0, 0), lattice(1, 0, 0), t.x);
+    float x10 = glm::mix(lattice(0, 1, 0), lattice(1, 1, 0), t.x);
+    float x01 = glm::mix(lattice(0, 0, 1), lattice(1, 0, 1), t.x);
+    float x11 = glm::mix(lattice(0, 1, 1), lattice(1, 1, 1), t.x);
+    return glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+}
+
+static uint64_t s_worldSeed = 0x2545f4914f6cdd1dull;
+
+void setWorldSeed(uint64_t seed) {
+    s_worldSeed = seed;
+}
+
+uint64_t worldSeed() {
+    return s_worldSeed;
+}
+
+// The SplitMix64 finalizer, which scrambles every input bit into every output bit
+static uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+float columnRandom(glm::ivec2 column, uint32_t counter) {
+    uint64_t key = uint64_t(uint32_t(column.x)) | uint64_t(uint32_t(column.y)) << 32;
+    uint64_t h = mix64(s_worldSeed ^ mix64(key));
+    h = mix64(h + (counter + 1) * 0x9e3779b97f4a7c15ull);
+    // The top 24 bits, which fit a float's mantissa exactly
+    return (h >> 40) * (1.f / (1 << 24));
+}
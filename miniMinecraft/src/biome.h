@@ -2,6 +2,8 @@
 #define BIOME_H
 
 #include "glm_includes.h"
+#include <cstdint>
+#include <vector>
 
 enum BiomeType : unsigned char
 {
@@ -16,8 +18,57 @@ float SimplexNoise(glm::vec3 pos);
 float WorleyNoise(glm::vec2 uv);
 glm::vec2 randomizeUV(glm::vec2 uv, float amp, float freq);
 
+/* ------------- Seeded Randomness -------------- */
+// The seed every world generation decision that is not made by the noise
+// functions depends on. Set it before any Chunk is generated.
+void setWorldSeed(uint64_t seed);
+uint64_t worldSeed();
+// A random float in [0, 1) that only depends on the world seed, the column
+// and the counter, so it is the same on every run and every thread.
+// Draw the n-th number of a column with counter n.
+float columnRandom(glm::ivec2 column, uint32_t counter);
+
 float peakHeight(glm::vec2 xz);
 float midHeight(glm::vec2 xz);
 float lowHeight(glm::vec2 xz);
 
+// Everything generateBlock needs to know about one column of terrain
+struct TerrainSample {
+    // Both remapped to [0, 1]
+    float weirdness, humidity;
+    float peak, mid, low;
+};
+// Computes the fbm domain warp and the Perlin octaves that peakHeight,
+// midHeight and lowHeight share once, and derives all three heights
+// from them. The heights are bit-identical to calling the three functions.
+TerrainSample sampleTerrain(glm::vec2 xz);
+
+// How CaveNoise evaluates the noise that carves caves.
+// CAVES_EXACT evaluates SimplexNoise at every block, CAVES_TRILINEAR
+// evaluates it every CAVE_LATTICE_STEP blocks and interpolates in between.
+enum CaveSampling : unsigned char
+{
+    CAVES_EXACT, CAVES_TRILINEAR
+};
+
+const int CAVE_LATTICE_STEP = 4;
+const int CAVE_MAX_Y = 128;
+
+// The 3D noise in [-1, 1] that carves the caves of one Chunk,
+// for y from 0 to CAVE_MAX_Y
+class CaveNoise {
+private:
+    glm::ivec2 m_origin;
+    CaveSampling m_sampling;
+    // The noise at every lattice point over the Chunk and one step past
+    // its far edges, indexed x + 5 * (z + 5 * y) in lattice steps
+    std::vector<float> m_lattice;
+
+public:
+    // origin is the Chunk's minimum corner in world space
+    CaveNoise(glm::ivec2 origin, CaveSampling sampling);
+    // Takes chunk-local coordinates
+    float at(int x, int y, int z) const;
+};
+
 #endif // BIOME_H
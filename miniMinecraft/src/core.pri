@@ -0,0 +1,61 @@
+# The world, its generation, meshing and saving, and the GL wrappers it
+# draws with: everything but the windows and widgets, shared by the game
+# and the bench target
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/biome.cpp \
+    $$PWD/noisebatch.cpp \
+    $$PWD/scene/FBMWorker.cpp \
+    $$PWD/scene/VBOWorker.cpp \
+    $$PWD/scene/SaveWorker.cpp \
+    $$PWD/scene/SortWorker.cpp \
+    $$PWD/shaderprogram.cpp \
+    $$PWD/drawable.cpp \
+    $$PWD/scene/cube.cpp \
+    $$PWD/openglcontext.cpp \
+    $$PWD/scene/terrain.cpp \
+    $$PWD/scene/terrainarena.cpp \
+    $$PWD/scene/worldaxes.cpp \
+    $$PWD/scene/entity.cpp \
+    $$PWD/scene/player.cpp \
+    $$PWD/scene/camera.cpp \
+    $$PWD/scene/frustum.cpp \
+    $$PWD/scene/chunk.cpp \
+    $$PWD/scene/blockstorage.cpp \
+    $$PWD/scene/chunkview.cpp \
+    $$PWD/scene/chunkscheduler.cpp \
+    $$PWD/scene/jobsystem.cpp \
+    $$PWD/scene/regionfile.cpp \
+    $$PWD/texture.cpp
+
+HEADERS += \
+    $$PWD/biome.h \
+    $$PWD/noisebatch.h \
+    $$PWD/noisebatchkernels.h \
+    $$PWD/shaderprogram.h \
+    $$PWD/drawable.h \
+    $$PWD/scene/cube.h \
+    $$PWD/openglcontext.h \
+    $$PWD/scene/terrain.h \
+    $$PWD/scene/terrainarena.h \
+    $$PWD/scene/worldaxes.h \
+    $$PWD/smartpointerhelp.h \
+    $$PWD/glm_includes.h \
+    $$PWD/scene/entity.h \
+    $$PWD/scene/player.h \
+    $$PWD/scene/camera.h \
+    $$PWD/scene/frustum.h \
+    $$PWD/scene/chunk.h \
+    $$PWD/scene/blockstorage.h \
+    $$PWD/scene/chunkview.h \
+    $$PWD/scene/chunkscheduler.h \
+    $$PWD/scene/jobsystem.h \
+    $$PWD/scene/mpscqueue.h \
+    $$PWD/scene/regionfile.h \
+    $$PWD/scene/FBMWorker.h \
+    $$PWD/scene/VBOWorker.h \
+    $$PWD/scene/SaveWorker.h \
+    $$PWD/scene/SortWorker.h \
+    $$PWD/texture.h
@@ -12,10 +12,12 @@ Drawable::~Drawable()
 
 void Drawable::destroyVBOdata()
 {
-    mp_context->glDeleteBuffers(1, &m_bufIdx);
-    mp_context->glDeleteBuffers(1, &m_bufPos);
-    mp_context->glDeleteBuffers(1, &m_bufNor);
-    mp_context->glDeleteBuffers(1, &m_bufCol);
+    // Only the buffers that were generated, so a Drawable that never
+    // created any can be destroyed without a context
+    if (m_idxGenerated) mp_context->glDeleteBuffers(1, &m_bufIdx);
+    if (m_posGenerated) mp_context->glDeleteBuffers(1, &m_bufPos);
+    if (m_norGenerated) mp_context->glDeleteBuffers(1, &m_bufNor);
+    if (m_colGenerated) mp_context->glDeleteBuffers(1, &m_bufCol);
     m_idxGenerated = m_posGenerated = m_norGenerated = m_colGenerated = false;
     m_count = -1;
 }
@@ -160,10 +162,10 @@ InterleavedDrawable::~InterleavedDrawable(){}
 void InterleavedDrawable::destroyVBOdata()
 {
     Drawable::destroyVBOdata();
-    mp_context->glDeleteBuffers(1, &m_bufIdxOpaque);
-    mp_context->glDeleteBuffers(1, &m_bufIdxTransparent);
-    mp_context->glDeleteBuffers(1, &m_bufVboOpaque);
-    mp_context->glDeleteBuffers(1, &m_bufVboTransparent);
+    if (m_idxOpaqueGenerated) mp_context->glDeleteBuffers(1, &m_bufIdxOpaque);
+    if (m_idxTransparentGenerated) mp_context->glDeleteBuffers(1, &m_bufIdxTransparent);
+    if (m_vboOpaqueGenerated) mp_context->glDeleteBuffers(1, &m_bufVboOpaque);
+    if (m_vboTransparentGenerated) mp_context->glDeleteBuffers(1, &m_bufVboTransparent);
     m_idxOpaqueGenerated = m_idxTransparentGenerated = m_vboOpaqueGenerated = m_vboTransparentGenerated = false;
     m_countOpaque = m_countTransparent = -1;
 }
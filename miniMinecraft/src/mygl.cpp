@@ -81,6 +81,7 @@ void MyGL::initializeGL()
     glBindVertexArray(vao);
 
     m_terrain.instantiateTexture();
+    m_terrain.createArena();
 }
 
 void MyGL::resizeGL(int w, int h) {
@@ -132,6 +133,12 @@ void MyGL::sendPlayerDataToGUI() const {
     glm::ivec2 zone(64 * glm::ivec2(glm::floor(pPos / 64.f)));
     emit sig_sendPlayerChunk(QString::fromStdString("( " + std::to_string(chunk.x) + ", " + std::to_string(chunk.y) + " )"));
     emit sig_sendPlayerTerrainZone(QString::fromStdString("( " + std::to_string(zone.x) + ", " + std::to_string(zone.y) + " )"));
+    const DrawStats &stats = m_terrain.drawStats();
+    emit sig_sendDrawStats(QString::fromStdString(std::to_string(stats.drawCalls) + " calls of " +
+                                                  std::to_string(stats.draws) + " draws, " +
+                                                  std::to_string(stats.chunksDrawn) + " chunks drawn, " +
+                                                  std::to_string(stats.chunksCulled) + " culled, " +
+                                                  std::to_string(static_cast<int>(stats.averageCpuNsecs / 1000)) + " us CPU"));
 }
 
 // This function is called whenever update() is called.
@@ -154,7 +161,8 @@ void MyGL::paintGL() {
     m_progSky.setEye(m_player.mcr_camera.mcr_position);
     m_progSky.draw(m_postQuad);
 
-    m_terrain.expandChunks(m_player.mcr_position, m_player.m_prevPos);
+    m_terrain.expandChunks(m_player.mcr_position, m_player.m_prevPos,
+                           m_player.mcr_camera.getForward());
     renderTerrain();
 
     glDisable(GL_DEPTH_TEST);
@@ -185,7 +193,11 @@ void MyGL::paintGL() {
 void MyGL::renderTerrain() {
     int x = 16 * static_cast<int>(glm::floor(m_player.mcr_position.x / 16.f));
     int z = 16 * static_cast<int>(glm::floor(m_player.mcr_position.z / 16.f));
-    m_terrain.draw(x - 128, x + 128, z - 128, z + 128, &m_progLambert);
+    m_terrain.draw(x - 128, x + 128, z - 128, z + 128,
+                   m_player.mcr_camera.getViewProj(), m_player.mcr_camera.mcr_position,
+                   &m_progLambert);
+    // The terrain is drawn with a vertex array object of its own
+    glBindVertexArray(vao);
 }
 
 
@@ -225,6 +237,9 @@ void MyGL::keyPressEvent(QKeyEvent *e) {
         m_player.m_flightMode = !m_player.m_flightMode;
     } else if (e->key() == Qt::Key_Space) {
         m_inputs.spacePressed = true;
+    } else if (e->key() == Qt::Key_G) {
+        m_terrain.setMeshingMode(Chunk::meshingMode() == GREEDY ? PER_FACE : GREEDY,
+                                 m_player.mcr_position);
     }
 }
 
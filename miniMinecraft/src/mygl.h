@@ -98,6 +98,8 @@ signals:
     void sig_sendPlayerLook(QString) const;
     void sig_sendPlayerChunk(QString) const;
     void sig_sendPlayerTerrainZone(QString) const;
+    // The draw calls and culled Chunks of the last frame
+    void sig_sendDrawStats(QString) const;
 
     // milestone 3: inventory
     void sig_sendInventory(bool) const;
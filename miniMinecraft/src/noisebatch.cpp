@@ -0,0 +1,207 @@
+#include "noisebatch.h"
+#include "biome.h"
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NOISE_SSE2
+#endif
+// The AVX2 kernel is compiled whenever the compiler can enable AVX2 for
+// single functions, and only run on CPUs that support it
+#if defined(__AVX2__) || ((defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)))
+#include <immintrin.h>
+#define NOISE_AVX2
+#endif
+
+// Every kernel below is written once as a template over its lane type F,
+// a float or a register of floats, and the matching unsigned integer lanes.
+template <typename F> struct Lanes;
+
+// ---------------------------------------------------------------------
+// One column at a time
+// ---------------------------------------------------------------------
+
+template <> struct Lanes<float> {
+    using U = uint32_t;
+    static const int N = 1;
+    static float iota() { return 0.f; }
+};
+
+inline float vfloor(float a) { return std::floor(a); }
+inline float vabs(float a) { return std::fabs(a); }
+inline float vsqrt(float a) { return std::sqrt(a); }
+inline float vmin(float a, float b) { return a < b ? a : b; }
+inline float vmax(float a, float b) { return a > b ? a : b; }
+// a must already be a whole number
+inline uint32_t vtoU(float a) { return static_cast<uint32_t>(static_cast<int32_t>(a)); }
+// The low and high 16 bits of h, scaled to [0, 1)
+inline float vlow16(uint32_t h) { return float(h & 0xffffu) * (1.f / 65536); }
+inline float vhigh16(uint32_t h) { return float(h >> 16) * (1.f / 65536); }
+// The top 24 bits of h, scaled to [0, 1)
+inline float vunit(uint32_t h) { return float(h >> 8) * (1.f / 16777216); }
+inline void vstore(float *p, float a) { *p = a; }
+
+// ---------------------------------------------------------------------
+// Four columns at a time
+// ---------------------------------------------------------------------
+#if defined(NOISE_SSE2)
+
+struct SseF {
+    __m128 v;
+    SseF(__m128 v) : v(v) {}
+    SseF(float a) : v(_mm_set1_ps(a)) {}
+};
+struct SseU {
+    __m128i v;
+    SseU(__m128i v) : v(v) {}
+    SseU(uint32_t a) : v(_mm_set1_epi32(static_cast<int>(a))) {}
+};
+
+template <> struct Lanes<SseF> {
+    using U = SseU;
+    static const int N = 4;
+    static SseF iota() { return _mm_setr_ps(0, 1, 2, 3); }
+};
+
+inline SseF operator+(SseF a, SseF b) { return _mm_add_ps(a.v, b.v); }
+inline SseF operator-(SseF a, SseF b) { return _mm_sub_ps(a.v, b.v); }
+inline SseF operator*(SseF a, SseF b) { return _mm_mul_ps(a.v, b.v); }
+inline SseF operator/(SseF a, SseF b) { return _mm_div_ps(a.v, b.v); }
+inline SseU operator+(SseU a, SseU b) { return _mm_add_epi32(a.v, b.v); }
+inline SseU operator^(SseU a, SseU b) { return _mm_xor_si128(a.v, b.v); }
+inline SseU operator&(SseU a, SseU b) { return _mm_and_si128(a.v, b.v); }
+inline SseU operator>>(SseU a, int n) { return _mm_srl_epi32(a.v, _mm_cvtsi32_si128(n)); }
+
+// SSE2 only multiplies the even 32-bit lanes into 64-bit products,
+// so multiply the odd lanes separately and interleave the low halves
+inline SseU operator*(SseU a, SseU b) {
+    __m128i even = _mm_mul_epu32(a.v, b.v);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// SSE2 has no floor, so truncate and step down where that rounded up
+inline SseF vfloor(SseF a) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f)));
+}
+inline SseF vabs(SseF a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+inline SseF vsqrt(SseF a) { return _mm_sqrt_ps(a.v); }
+inline SseF vmin(SseF a, SseF b) { return _mm_min_ps(a.v, b.v); }
+inline SseF vmax(SseF a, SseF b) { return _mm_max_ps(a.v, b.v); }
+inline SseU vtoU(SseF a) { return _mm_cvttps_epi32(a.v); }
+inline SseF vlow16(SseU h) { return SseF(_mm_cvtepi32_ps((h & 0xffffu).v)) * (1.f / 65536); }
+inline SseF vhigh16(SseU h) { return SseF(_mm_cvtepi32_ps((h >> 16).v)) * (1.f / 65536); }
+inline SseF vunit(SseU h) { return SseF(_mm_cvtepi32_ps((h >> 8).v)) * (1.f / 16777216); }
+inline void vstore(float *p, SseF a) { _mm_storeu_ps(p, a.v); }
+
+using WideF = SseF;
+
+#else
+
+using WideF = float;
+
+#endif
+
+// One column, or four with SSE2, at a time, for any x86-64 CPU
+namespace baseline {
+#include "noisebatchkernels.h"
+}
+
+// ---------------------------------------------------------------------
+// Eight columns at a time, with AVX2 enabled for every function up to
+// the end of the avx2 namespace
+// ---------------------------------------------------------------------
+#if defined(NOISE_AVX2)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+struct AvxF {
+    __m256 v;
+    AvxF(__m256 v) : v(v) {}
+    AvxF(float a) : v(_mm256_set1_ps(a)) {}
+};
+struct AvxU {
+    __m256i v;
+    AvxU(__m256i v) : v(v) {}
+    AvxU(uint32_t a) : v(_mm256_set1_epi32(static_cast<int>(a))) {}
+};
+
+template <> struct Lanes<AvxF> {
+    using U = AvxU;
+    static const int N = 8;
+    static AvxF iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+};
+
+inline AvxF operator+(AvxF a, AvxF b) { return _mm256_add_ps(a.v, b.v); }
+inline AvxF operator-(AvxF a, AvxF b) { return _mm256_sub_ps(a.v, b.v); }
+inline AvxF operator*(AvxF a, AvxF b) { return _mm256_mul_ps(a.v, b.v); }
+inline AvxF operator/(AvxF a, AvxF b) { return _mm256_div_ps(a.v, b.v); }
+inline AvxU operator+(AvxU a, AvxU b) { return _mm256_add_epi32(a.v, b.v); }
+inline AvxU operator*(AvxU a, AvxU b) { return _mm256_mullo_epi32(a.v, b.v); }
+inline AvxU operator^(AvxU a, AvxU b) { return _mm256_xor_si256(a.v, b.v); }
+inline AvxU operator&(AvxU a, AvxU b) { return _mm256_and_si256(a.v, b.v); }
+inline AvxU operator>>(AvxU a, int n) { return _mm256_srl_epi32(a.v, _mm_cvtsi32_si128(n)); }
+
+inline AvxF vfloor(AvxF a) { return _mm256_floor_ps(a.v); }
+inline AvxF vabs(AvxF a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+inline AvxF vsqrt(AvxF a) { return _mm256_sqrt_ps(a.v); }
+inline AvxF vmin(AvxF a, AvxF b) { return _mm256_min_ps(a.v, b.v); }
+inline AvxF vmax(AvxF a, AvxF b) { return _mm256_max_ps(a.v, b.v); }
+inline AvxU vtoU(AvxF a) { return _mm256_cvttps_epi32(a.v); }
+inline AvxF vlow16(AvxU h) { return AvxF(_mm256_cvtepi32_ps((h & 0xffffu).v)) * (1.f / 65536); }
+inline AvxF vhigh16(AvxU h) { return AvxF(_mm256_cvtepi32_ps((h >> 16).v)) * (1.f / 65536); }
+inline AvxF vunit(AvxU h) { return AvxF(_mm256_cvtepi32_ps((h >> 8).v)) * (1.f / 16777216); }
+inline void vstore(float *p, AvxF a) { _mm256_storeu_ps(p, a.v); }
+
+namespace avx2 {
+#include "noisebatchkernels.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
+
+// Whether the CPU running the game can run the AVX2 kernel
+static bool hasAvx2() {
+#if defined(__AVX2__)
+    return true;
+#elif defined(NOISE_AVX2)
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+void terrainHeightsBatch(glm::ivec2 origin, TerrainHeightsBatch &out) {
+#if defined(NOISE_AVX2)
+    if (hasAvx2()) {
+        avx2::heightsKernel<AvxF>(origin, out);
+        return;
+    }
+#endif
+    baseline::heightsKernel<WideF>(origin, out);
+}
+
+void terrainHeightsBatchScalar(glm::ivec2 origin, TerrainHeightsBatch &out) {
+    baseline::heightsKernel<float>(origin, out);
+}
+
+const char* noiseBatchInstructionSet() {
+    if (hasAvx2()) return "AVX2";
+#if defined(NOISE_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef NOISEBATCH_H
+#define NOISEBATCH_H
+
+#include "glm_includes.h"
+#include <array>
+
+// Terrain noise for the whole 16 x 16 footprint of a Chunk at once.
+// Neighbouring columns share one AVX2 register on CPUs that support it,
+// checked when the game runs, or an SSE register otherwise, and lattice
+// points are hashed with integer arithmetic instead of sin. The hash
+// differs from the one PerlinNoise and fbm in biome.cpp use, so the
+// heights follow the same recipe as peakHeight, midHeight and lowHeight
+// but do not match them, which is why Chunk generation does not use it.
+
+// Indexed x + 16 * z, relative to the footprint's minimum corner
+using NoiseBatch = std::array<float, 16 * 16>;
+
+struct TerrainHeightsBatch {
+    NoiseBatch peak, mid, low;
+};
+
+// Fills out with the three terrain heights of every column of the
+// footprint whose minimum corner is origin, using the widest lanes available
+void terrainHeightsBatch(glm::ivec2 origin, TerrainHeightsBatch &out);
+// The same, one column at a time
+void terrainHeightsBatchScalar(glm::ivec2 origin, TerrainHeightsBatch &out);
+// The instruction set terrainHeightsBatch uses on this CPU
+const char* noiseBatchInstructionSet();
+
+#endif // NOISEBATCH_H
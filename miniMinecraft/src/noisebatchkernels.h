@@ -0,0 +1,125 @@
+// The terrain noise kernels of noisebatch.cpp, written once as templates
+// over their lane type. noisebatch.cpp includes this once for every
+// instruction set, each time in a namespace of its own and with that
+// instruction set enabled, so there is no include guard.
+
+// Scrambles a 2D lattice point into 32 random bits
+template <typename U>
+inline U hashLattice(U x, U y, U seed) {
+    U h = (x * 0x8da6b343u) ^ (y * 0xd8163841u) ^ seed;
+    h = h ^ (h >> 16);
+    h = h * 0x7feb352du;
+    h = h ^ (h >> 15);
+    h = h * 0x846ca68bu;
+    return h ^ (h >> 16);
+}
+
+template <typename F>
+inline F mixLanes(F a, F b, F t) {
+    return a + (b - a) * t;
+}
+
+// Value noise in [0, 1), smoothly interpolated like noise() in biome.cpp
+template <typename F, typename U = typename Lanes<F>::U>
+F valueNoise(F x, F y, U seed) {
+    F fx = vfloor(x), fy = vfloor(y);
+    F tx = x - fx, ty = y - fy;
+    U ix = vtoU(fx), iy = vtoU(fy);
+
+    F v00 = vunit(hashLattice<U>(ix, iy, seed));
+    F v10 = vunit(hashLattice<U>(ix + 1u, iy, seed));
+    F v01 = vunit(hashLattice<U>(ix, iy + 1u, seed));
+    F v11 = vunit(hashLattice<U>(ix + 1u, iy + 1u, seed));
+
+    F sx = tx * tx * (3.f - 2.f * tx);
+    F sy = ty * ty * (3.f - 2.f * ty);
+    return mixLanes(mixLanes(v00, v10, sx), mixLanes(v01, v11, sx), sy);
+}
+
+// Eight octaves of value noise, like fbm() in biome.cpp
+template <typename F, typename U = typename Lanes<F>::U>
+F fbmLanes(F x, F y, U seed) {
+    F n = 0.f;
+    float a = 0.5f;
+    float f = 5.0f;
+    for (int i = 0; i < 8; i++) {
+        n = n + valueNoise<F>(x * f, y * f, seed) * a;
+        a *= 0.5f;
+        f *= 2.0f;
+    }
+    return n;
+}
+
+// 1 - 6t^5 + 15t^4 - 10t^3 of the distance along one axis
+template <typename F>
+inline F falloff(F d) {
+    F t = vabs(d);
+    return 1.f - t * t * t * (10.f - 15.f * t + 6.f * t * t);
+}
+
+// The contribution of one lattice point to 2D Perlin noise, like surflet()
+// in biome.cpp but with the gradient direction taken from the hash
+template <typename F, typename U = typename Lanes<F>::U>
+F surfletLanes(F x, F y, F gx, F gy, U seed) {
+    U h = hashLattice<U>(vtoU(gx), vtoU(gy), seed);
+    F dx = vlow16(h) * 2.f - 1.f;
+    F dy = vhigh16(h) * 2.f - 1.f;
+    F len = vsqrt(vmax(dx * dx + dy * dy, 1e-8f));
+
+    F px = x - gx, py = y - gy;
+    return (px * dx + py * dy) / len * falloff(px) * falloff(py);
+}
+
+template <typename F, typename U = typename Lanes<F>::U>
+F perlinLanes(F x, F y, U seed) {
+    F gx = vfloor(x), gy = vfloor(y);
+    return surfletLanes<F>(x, y, gx, gy, seed) +
+           surfletLanes<F>(x, y, gx + 1.f, gy, seed) +
+           surfletLanes<F>(x, y, gx + 1.f, gy + 1.f, seed) +
+           surfletLanes<F>(x, y, gx, gy + 1.f, seed);
+}
+
+// peakHeight, midHeight and lowHeight of the columns at (x, z).
+// Those compute the fbm domain warp once per octave, this once per column.
+template <typename F, typename U = typename Lanes<F>::U>
+void columnHeights(F x, F z, U seed, F &peak, F &mid, F &low) {
+    F ox = fbmLanes<F>(x * (1.f / 256), z * (1.f / 256), seed);
+    F oy = fbmLanes<F>(x * (1.f / 300), z * (1.f / 300), seed) + 1000.f;
+    F wx = x + ox * 75.f;
+    F wz = z + oy * 75.f;
+
+    U perlinSeed = seed ^ 0x68e31da4u;
+    F h = 0.f;
+    float amp = 0.5f;
+    float freq = 128.0f;
+    for (int i = 0; i < 4; i++) {
+        h = h + perlinLanes<F>(wx * (1.f / freq), wz * (1.f / freq), perlinSeed) * amp;
+        amp *= 0.5f;
+        freq *= 2.0f;
+    }
+
+    // smoothstep(0, 0.75, (h + 1) / 2)
+    F p = vmin(vmax((h + 1.f) * 0.5f * (1.f / 0.75f), 0.f), 1.f);
+    p = p * p * (3.f - 2.f * p);
+    peak = vfloor(15.f + p * p * 100.f);
+    mid = vfloor(15.f + h * 75.f);
+    low = vfloor(15.f + h * 50.f);
+}
+
+template <typename F>
+void heightsKernel(glm::ivec2 origin, TerrainHeightsBatch &out) {
+    using U = typename Lanes<F>::U;
+    const U seed = static_cast<uint32_t>(worldSeed() ^ (worldSeed() >> 32));
+
+    for (int z = 0; z < 16; z++) {
+        F zw = float(origin.y + z);
+        for (int x = 0; x < 16; x += Lanes<F>::N) {
+            F xw = F(float(origin.x + x)) + Lanes<F>::iota();
+            F peak = 0.f, mid = 0.f, low = 0.f;
+            columnHeights<F>(xw, zw, seed, peak, mid, low);
+            vstore(&out.peak[x + 16 * z], peak);
+            vstore(&out.mid[x + 16 * z], mid);
+            vstore(&out.low[x + 16 * z], low);
+        }
+    }
+}
@@ -71,6 +71,7 @@ void OpenGLContext::debugContextVersion()
 
 void OpenGLContext::printGLErrorLog()
 {
+#ifndef QT_NO_DEBUG
     GLenum error = glGetError();
     if (error != GL_NO_ERROR) {
         std::cerr << "OpenGL error " << error << ": ";
@@ -89,6 +90,7 @@ void OpenGLContext::printGLErrorLog()
         throw;
 #endif
     }
+#endif
 }
 
 void OpenGLContext::printLinkInfoLog(int prog)
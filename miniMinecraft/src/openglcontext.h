@@ -15,6 +15,9 @@ public:
     ~OpenGLContext();
 
     void debugContextVersion();
+    // Checks glGetError, which waits for the GPU to catch up, so only in
+    // debug builds. Does nothing when QT_NO_DEBUG is defined, as it is for
+    // CONFIG += release.
     void printGLErrorLog();
     void printLinkInfoLog(int prog);
     void printShaderInfoLog(int shader);
@@ -1,17 +1,19 @@
 #include "FBMWorker.h"
 
 
-FBMWorker::FBMWorker(int m_xCorner, int m_zCorner, std::vector<Chunk *> m_chunksToGenerate,
-                                 std::unordered_set<Chunk *>* mp_chunksCompleteds, QMutex * m_chunkCompletedLock)
-    : m_xCorner(m_xCorner), m_zCorner(m_zCorner), m_chunksToGenerate(m_chunksToGenerate), mp_chunksCompleteds(mp_chunksCompleteds),
-    m_chunkCompletedLock(m_chunkCompletedLock){}
+FBMWorker::FBMWorker(Chunk * c, GenerationStage stage, JobSystem * mp_jobs, RegionStore * mp_regions)
+    : m_chunk(c), m_stage(stage), mp_jobs(mp_jobs), mp_regions(mp_regions)
+{}
 
 
 void FBMWorker::run() {
-    for (Chunk * c:  m_chunksToGenerate){
-        c->generateChunk(c->minX, c->minZ);
-        m_chunkCompletedLock->lock();
-        mp_chunksCompleteds->insert(c);
-        m_chunkCompletedLock->unlock();
+    if (m_stage == BASE_TERRAIN) {
+        if (!mp_regions || !mp_regions->load(m_chunk)) {
+            m_chunk->generateBaseTerrain(m_chunk->minX, m_chunk->minZ, Chunk::caveSampling());
+        }
+        mp_jobs->complete(GENERATE_JOB, m_chunk);
+    } else {
+        m_chunk->decorate();
+        mp_jobs->complete(DECORATE_JOB, m_chunk);
     }
 }
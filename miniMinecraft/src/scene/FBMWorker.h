@@ -2,20 +2,23 @@
 #define FBMWORKER_H
 
 #include "chunk.h"
+#include "jobsystem.h"
+#include "regionfile.h"
 #include <QRunnable>
-#include <QMutex>
-#include <unordered_set>
 
+// Brings one Chunk to the given GenerationStage, which must be
+// the one after the stage it is at. With a RegionStore, the base
+// terrain stage loads the Chunk's saved record instead if it has one,
+// which takes it straight to DECORATED.
 class FBMWorker : public QRunnable
 {
 private:
-    int m_xCorner, m_zCorner;
-    std::vector<Chunk *> m_chunksToGenerate;
-    std::unordered_set<Chunk *>* mp_chunksCompleteds;
-    QMutex * m_chunkCompletedLock;
+    Chunk * m_chunk;
+    GenerationStage m_stage;
+    JobSystem * mp_jobs;
+    RegionStore * mp_regions;
 public:
-    FBMWorker(int m_xCorner, int m_zCorner, std::vector<Chunk *> m_chunksToGenerate,
-              std::unordered_set<Chunk *>* mp_chunksCompleteds, QMutex * m_chunkCompletedLock);
+    FBMWorker(Chunk * c, GenerationStage stage, JobSystem * mp_jobs, RegionStore * mp_regions = nullptr);
 
     void run() override;
 };
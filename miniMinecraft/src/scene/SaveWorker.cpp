@@ -0,0 +1,12 @@
+#include "SaveWorker.h"
+
+
+SaveWorker::SaveWorker(RegionStore * mp_regions, JobSystem * mp_jobs)
+    : mp_regions(mp_regions), mp_jobs(mp_jobs)
+{}
+
+
+void SaveWorker::run() {
+    mp_regions->flush();
+    mp_jobs->complete(SAVE_JOB, nullptr);
+}
@@ -0,0 +1,21 @@
+#ifndef SAVEWORKER_H
+#define SAVEWORKER_H
+
+#include "jobsystem.h"
+#include "regionfile.h"
+#include <QRunnable>
+
+// Writes the snapshots queued in a RegionStore to disk
+class SaveWorker : public QRunnable
+{
+private:
+    RegionStore * mp_regions;
+    JobSystem * mp_jobs;
+
+public:
+    SaveWorker(RegionStore * mp_regions, JobSystem * mp_jobs);
+
+    void run() override;
+};
+
+#endif // SAVEWORKER_H
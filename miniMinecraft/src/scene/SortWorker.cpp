@@ -0,0 +1,23 @@
+#include "SortWorker.h"
+
+
+SortWorker::SortWorker(const std::vector<Chunk*> &chunks, glm::vec3 eye, JobSystem * mp_jobs)
+    : m_entries(), mp_jobs(mp_jobs)
+{
+    m_entries.reserve(chunks.size());
+    for (Chunk *c : chunks) {
+        m_entries.push_back(Entry{c, c->mesh().vboTransparent, c->mesh().transparentSlots,
+                                  eye - glm::vec3(c->minX, 0, c->minZ)});
+    }
+}
+
+
+void SortWorker::run() {
+    for (Entry &e : m_entries) {
+        Chunk::sortTransparentQuads(e.vbo, e.sections, e.eye);
+        ChunkMesh mesh;
+        mesh.vboTransparent = std::move(e.vbo);
+        mesh.transparentSlots = e.sections;
+        mp_jobs->complete(SORT_JOB, e.chunk, std::move(mesh));
+    }
+}
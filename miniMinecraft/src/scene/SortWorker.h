@@ -0,0 +1,31 @@
+#ifndef SORTWORKER_H
+#define SORTWORKER_H
+
+#include "chunk.h"
+#include "jobsystem.h"
+#include <QRunnable>
+
+// Sorts copies of the transparent quads of a batch of Chunks back to
+// front for the camera, see Chunk::sortTransparentQuads, and hands each
+// Chunk's back as a completion of its own
+class SortWorker : public QRunnable
+{
+private:
+    struct Entry {
+        Chunk * chunk;
+        std::vector<Vertex> vbo;
+        std::array<SectionSlots, 16> sections;
+        // Relative to the Chunk's corner
+        glm::vec3 eye;
+    };
+    std::vector<Entry> m_entries;
+    JobSystem * mp_jobs;
+
+public:
+    // Copies the quads here, on the main thread
+    SortWorker(const std::vector<Chunk*> &chunks, glm::vec3 eye, JobSystem * mp_jobs);
+
+    void run() override;
+};
+
+#endif // SORTWORKER_H
@@ -1,14 +1,15 @@
 #include "VBOWorker.h"
 
 
-VBOWorker::VBOWorker(Chunk * c, std::unordered_set<Chunk *> * m_VBOChunks, QMutex * m_VBOChunksLock)
-    : m_chunk(c), m_VBOChunks(m_VBOChunks), m_VBOChunksLock(m_VBOChunksLock)
+VBOWorker::VBOWorker(Chunk * c, ChunkView view, JobSystem * mp_jobs)
+    : m_chunk(c), m_view(std::move(view)), mp_jobs(mp_jobs)
 {}
 
 
 void VBOWorker::run() {
-    m_chunk->createVBOdata();
-    m_VBOChunksLock->lock();
-    m_VBOChunks->insert(m_chunk);
-    m_VBOChunksLock->unlock();
+    // Build into our own mesh, since the main thread may be
+    // drawing or uploading the Chunk's current one
+    ChunkMesh mesh;
+    m_chunk->buildMesh(m_view, Chunk::meshingMode(), mesh);
+    mp_jobs->complete(MESH_JOB, m_chunk, std::move(mesh));
 }
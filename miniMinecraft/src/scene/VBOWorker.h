@@ -2,20 +2,19 @@
 #define VBOWORKER_H
 
 #include "chunk.h"
+#include "chunkview.h"
+#include "jobsystem.h"
 #include <QRunnable>
-#include <QMutex>
-#include <unordered_set>
-
 
 class VBOWorker : public QRunnable
 {
 private:
     Chunk * m_chunk;
-    std::unordered_set<Chunk *>* m_VBOChunks;
-    QMutex * m_VBOChunksLock;
+    ChunkView m_view;
+    JobSystem * mp_jobs;
 
 public:
-    VBOWorker(Chunk * c, std::unordered_set<Chunk *> * m_VBOChunks, QMutex * m_VBOChunksLock);
+    VBOWorker(Chunk * c, ChunkView view, JobSystem * mp_jobs);
 
     void run() override;
 };
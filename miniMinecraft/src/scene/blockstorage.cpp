@@ -0,0 +1,189 @@
+#include "blockstorage.h"
+#include "chunk.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+BlockStorage::BlockStorage(size_t size, BlockType fill)
+    : m_size(size), m_log2Bits(-1), m_palette{fill},
+      m_counts{static_cast<uint32_t>(size)}, m_data(),
+      mp_borrowed(nullptr), m_borrowedOwner()
+{}
+
+std::unique_ptr<BlockStorage> BlockStorage::fromPacked(size_t size, unsigned int bitsPerBlock,
+                                                       const std::vector<BlockType> &palette,
+                                                       const uint64_t *words,
+                                                       std::shared_ptr<const void> owner) {
+    int log2Bits = -1;
+    for (int l = 0; l <= 3; l++) {
+        if (bitsPerBlock == 1u << l) log2Bits = l;
+    }
+    if (log2Bits < 0 || palette.empty() || palette.size() > (size_t(1) << bitsPerBlock)
+        || (size * bitsPerBlock) % 64 != 0) {
+        return nullptr;
+    }
+    // A type listed twice would leave its blocks split between two
+    // counts, with only one of them found when the type is looked up
+    std::vector<BlockType> sorted(palette);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        return nullptr;
+    }
+
+    std::unique_ptr<BlockStorage> storage = std::make_unique<BlockStorage>(size, palette[0]);
+    storage->m_log2Bits = log2Bits;
+    storage->m_palette = palette;
+    storage->m_counts.assign(palette.size(), 0);
+    if (owner) {
+        storage->mp_borrowed = words;
+        storage->m_borrowedOwner = std::move(owner);
+    } else {
+        storage->m_data.assign(words, words + packedWordCount(size, bitsPerBlock));
+    }
+
+    // Counting the blocks of each type also checks every index
+    for (size_t i = 0; i < size; i++) {
+        unsigned int idx = storage->paletteIndexAt(i);
+        if (idx >= palette.size()) return nullptr;
+        storage->m_counts[idx]++;
+    }
+    return storage;
+}
+
+unsigned int BlockStorage::paletteIndexAt(size_t i) const {
+    if (m_log2Bits < 0) return 0;
+    // 64 bits per word, so there are 2^(6 - log2Bits) indices per word
+    int perWordLog2 = 6 - m_log2Bits;
+    uint64_t word = mp_borrowed ? mp_borrowed[i >> perWordLog2] : m_data[i >> perWordLog2];
+    unsigned int shift = (i & ((size_t(1) << perWordLog2) - 1)) << m_log2Bits;
+    uint64_t mask = (uint64_t(1) << (1 << m_log2Bits)) - 1;
+    return static_cast<unsigned int>((word >> shift) & mask);
+}
+
+void BlockStorage::setPaletteIndexAt(size_t i, unsigned int idx) {
+    int perWordLog2 = 6 - m_log2Bits;
+    uint64_t &word = m_data[i >> perWordLog2];
+    unsigned int shift = (i & ((size_t(1) << perWordLog2) - 1)) << m_log2Bits;
+    uint64_t mask = (uint64_t(1) << (1 << m_log2Bits)) - 1;
+    word = (word & ~(mask << shift)) | (uint64_t(idx) << shift);
+}
+
+void BlockStorage::promote() {
+    BlockStorage wider(*this);
+    wider.m_log2Bits = m_log2Bits + 1;
+    wider.m_data.assign(((m_size << wider.m_log2Bits) + 63) / 64, 0);
+    if (m_log2Bits >= 0) {
+        for (size_t i = 0; i < m_size; i++) {
+            wider.setPaletteIndexAt(i, paletteIndexAt(i));
+        }
+    }
+    *this = std::move(wider);
+}
+
+void BlockStorage::detach() {
+    if (!mp_borrowed) return;
+    m_data.assign(mp_borrowed, mp_borrowed + packedWordCount(m_size, bitsPerBlock()));
+    mp_borrowed = nullptr;
+    m_borrowedOwner.reset();
+}
+
+BlockType BlockStorage::get(size_t i) const {
+    if (i >= m_size) {
+        throw std::out_of_range("Block index " + std::to_string(i) + " is out of range!");
+    }
+    return m_palette[paletteIndexAt(i)];
+}
+
+void BlockStorage::set(size_t i, BlockType t) {
+    if (i >= m_size) {
+        throw std::out_of_range("Block index " + std::to_string(i) + " is out of range!");
+    }
+    unsigned int oldIdx = paletteIndexAt(i);
+    auto it = std::find(m_palette.begin(), m_palette.end(), t);
+    unsigned int idx = it - m_palette.begin();
+    if (idx == oldIdx) return;
+    detach();
+
+    if (it == m_palette.end()) {
+        // Reuse the entry of a type that is no longer stored, if any
+        auto unused = std::find(m_counts.begin(), m_counts.end(), 0u);
+        idx = unused - m_counts.begin();
+        if (unused != m_counts.end()) {
+            m_palette[idx] = t;
+        } else {
+            m_palette.push_back(t);
+            m_counts.push_back(0);
+            // Widen the indices until the new palette entry is addressable
+            while (m_log2Bits < 0 || m_palette.size() > (size_t(1) << (1 << m_log2Bits))) {
+                promote();
+            }
+        }
+    }
+    setPaletteIndexAt(i, idx);
+    m_counts[oldIdx]--;
+    m_counts[idx]++;
+
+    // Everything is the same type again, so the indices can be dropped
+    if (m_counts[idx] == m_size) {
+        m_palette.assign(1, t);
+        m_counts.assign(1, static_cast<uint32_t>(m_size));
+        m_data.clear();
+        m_data.shrink_to_fit();
+        m_log2Bits = -1;
+    }
+}
+
+size_t BlockStorage::size() const {
+    return m_size;
+}
+
+unsigned int BlockStorage::bitsPerBlock() const {
+    return m_log2Bits < 0 ? 0 : 1 << m_log2Bits;
+}
+
+size_t BlockStorage::paletteSize() const {
+    return m_palette.size();
+}
+
+size_t BlockStorage::count(BlockType t) const {
+    auto it = std::find(m_palette.begin(), m_palette.end(), t);
+    return it == m_palette.end() ? 0 : m_counts[it - m_palette.begin()];
+}
+
+bool BlockStorage::isUniform(BlockType *out_type) const {
+    for (size_t i = 0; i < m_palette.size(); i++) {
+        if (m_counts[i] == m_size) {
+            if (out_type) *out_type = m_palette[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::vector<BlockType>& BlockStorage::palette() const {
+    return m_palette;
+}
+
+const uint64_t* BlockStorage::packedWords() const {
+    if (m_log2Bits < 0) return nullptr;
+    return mp_borrowed ? mp_borrowed : m_data.data();
+}
+
+size_t BlockStorage::packedWordCount(size_t size, unsigned int bitsPerBlock) {
+    return (size * bitsPerBlock + 63) / 64;
+}
+
+bool BlockStorage::isBorrowed() const {
+    return mp_borrowed != nullptr;
+}
+
+size_t BlockStorage::borrowedBytes() const {
+    return mp_borrowed ? packedWordCount(m_size, bitsPerBlock()) * sizeof(uint64_t) : 0;
+}
+
+size_t BlockStorage::memoryUsage() const {
+    return sizeof(BlockStorage) +
+           m_palette.capacity() * sizeof(BlockType) +
+           m_counts.capacity() * sizeof(uint32_t) +
+           m_data.capacity() * sizeof(uint64_t);
+}
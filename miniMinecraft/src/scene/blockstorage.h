@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+enum BlockType : unsigned char;
+
+// Palette-compressed storage for the blocks of a Chunk.
+// Every distinct BlockType stored is given an index into a small
+// palette, and only these indices are kept, bit-packed into 64-bit
+// words. An index takes 0, 1, 2, 4 or 8 bits depending on how many
+// distinct types have been stored, so a power of two always divides
+// a word and no index straddles two words. The width is promoted
+// transparently whenever a new type no longer fits in the palette,
+// and the storage collapses back to a single palette entry once
+// every block has been overwritten with the same type.
+// The indices may also be borrowed from memory owned elsewhere, such as
+// a mapped region file, in which case they are copied on the first set().
+class BlockStorage {
+private:
+    size_t m_size;
+    // log2 of the number of bits per index, or -1 while only
+    // one type is stored and no indices are needed at all
+    int m_log2Bits;
+    std::vector<BlockType> m_palette;
+    // How many blocks refer to each palette entry
+    std::vector<uint32_t> m_counts;
+    std::vector<uint64_t> m_data;
+    // The indices, when they are borrowed instead of kept in m_data,
+    // and what keeps the memory they are in alive
+    const uint64_t *mp_borrowed;
+    std::shared_ptr<const void> m_borrowedOwner;
+
+    unsigned int paletteIndexAt(size_t i) const;
+    void setPaletteIndexAt(size_t i, unsigned int idx);
+    // Re-packs every index with twice as many bits
+    void promote();
+    // Copies borrowed indices into m_data
+    void detach();
+
+public:
+    // Creates storage for size blocks, all of the given type
+    BlockStorage(size_t size, BlockType fill);
+    // Creates storage for size blocks whose indices into the given palette
+    // are the bitsPerBlock-bit fields of the packedWordCount(size,
+    // bitsPerBlock) words at words, laid out like packedWords(). If owner is
+    // given the words are borrowed, and must not change while owner lives;
+    // otherwise they are copied. Returns nullptr if an index lies past the
+    // palette, the palette lists a type twice, or the words do not fit the
+    // size and width.
+    static std::unique_ptr<BlockStorage> fromPacked(size_t size, unsigned int bitsPerBlock,
+                                                    const std::vector<BlockType> &palette,
+                                                    const uint64_t *words,
+                                                    std::shared_ptr<const void> owner = nullptr);
+
+    // Both throw std::out_of_range if i >= size()
+    BlockType get(size_t i) const;
+    void set(size_t i, BlockType t);
+
+    size_t size() const;
+    unsigned int bitsPerBlock() const;
+    size_t paletteSize() const;
+    // How many of the stored blocks are of type t
+    size_t count(BlockType t) const;
+    // Do all stored blocks have the same type? If so, and out_type
+    // is given, it is set to that type.
+    bool isUniform(BlockType *out_type = nullptr) const;
+    // The palette the indices refer to, which may hold types
+    // no block is any longer of
+    const std::vector<BlockType>& palette() const;
+    // The packed indices, bitsPerBlock() bits each, lowest bits first.
+    // Null while every block has the same type.
+    const uint64_t* packedWords() const;
+    static size_t packedWordCount(size_t size, unsigned int bitsPerBlock);
+    // Whether the indices are still borrowed, see fromPacked
+    bool isBorrowed() const;
+    // The bytes this storage occupies, including its heap allocations
+    // but not the borrowed indices
+    size_t memoryUsage() const;
+    // The bytes of the borrowed indices
+    size_t borrowedBytes() const;
+};
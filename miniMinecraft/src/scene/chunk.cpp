@@ -1,86 +1,447 @@
 #include "chunk.h"
+#include "chunkview.h"
 #include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 Chunk::Chunk(OpenGLContext *context, int x, int z)
-    : InterleavedDrawable(context), m_blocks(), minX(x), minZ(z),
-      m_neighbors{
-          {XPOS, nullptr}, {XNEG, nullptr}, {ZPOS, nullptr}, {ZNEG, nullptr}} {
-  std::fill_n(m_blocks.begin(), 65536, EMPTY);
+    : InterleavedDrawable(context), m_sections(), m_neighbors(), minX(x), minZ(z) {
 }
 
 Chunk::~Chunk() { destroyVBOdata(); }
 
-// Does bounds checking with at()
+// Does bounds checking in BlockStorage::get()
 BlockType Chunk::getBlockAt(unsigned int x, unsigned int y, unsigned int z) const {
-    return m_blocks.at(x + 16 * y + 16 * 256 * z);
+    const uPtr<BlockStorage> &section = m_sections.at(y / 16);
+    if (!section) {
+        if (x >= 16 || z >= 16) {
+            throw std::out_of_range("Block coordinates are out of range!");
+        }
+        return EMPTY;
+    }
+    return section->get(x + 16 * (y % 16) + 16 * 16 * z);
 }
 
 // Exists to get rid of compiler warnings about int -> unsigned int implicit conversion
 BlockType Chunk::getBlockAt(int x, int y, int z) const {
     if (x < 0) {
-        return m_neighbors.at(XNEG) ? m_neighbors.at(XNEG)->getBlockAt(15, y, z) : UNKNOWN;
+        return m_neighbors[XNEG] ? m_neighbors[XNEG]->getBlockAt(15, y, z) : UNKNOWN;
     } else if (x >= 16) {
-        return m_neighbors.at(XPOS) ? m_neighbors.at(XPOS)->getBlockAt( 0, y, z) : UNKNOWN;
+        return m_neighbors[XPOS] ? m_neighbors[XPOS]->getBlockAt( 0, y, z) : UNKNOWN;
     } else if (y < 0) {
         return UNKNOWN;
     } else if (y >= 256) {
         return EMPTY;
     } else if (z < 0) {
-        return m_neighbors.at(ZNEG) ? m_neighbors.at(ZNEG)->getBlockAt(x, y, 15) : UNKNOWN;
+        return m_neighbors[ZNEG] ? m_neighbors[ZNEG]->getBlockAt(x, y, 15) : UNKNOWN;
     } else if (z >= 16) {
-        return m_neighbors.at(ZPOS) ? m_neighbors.at(ZPOS)->getBlockAt(x, y,  0) : UNKNOWN;
+        return m_neighbors[ZPOS] ? m_neighbors[ZPOS]->getBlockAt(x, y,  0) : UNKNOWN;
     } else {
         return getBlockAt(static_cast<unsigned int>(x), static_cast<unsigned int>(y), static_cast<unsigned int>(z));
     }
 }
 
-// Does bounds checking with at()
+// Does bounds checking in BlockStorage::set()
 void Chunk::setBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t) {
-    m_blocks.at(x + 16 * y + 16 * 256 * z) = t;
-
-    // invalidate VBO
-    validVBOonCPU = false;
-    if (t == EMPTY) {
-        // neighbors need to be updated
-        if (x == 0 && m_neighbors.at(XNEG)) {
-            m_neighbors.at(XNEG)->validVBOonCPU = false;
-        } else if (x == 15 && m_neighbors.at(XPOS)) {
-            m_neighbors.at(XPOS)->validVBOonCPU = false;
-        }
-        if (z == 0 && m_neighbors.at(ZNEG)) {
-            m_neighbors.at(ZNEG)->validVBOonCPU = false;
-        } else if (z == 15 && m_neighbors.at(ZPOS)) {
-            m_neighbors.at(ZPOS)->validVBOonCPU = false;
-        }
+    uPtr<BlockStorage> &section = m_sections.at(y / 16);
+    if (!section) {
+        section = mkU<BlockStorage>(16 * 16 * 16, EMPTY);
     }
+    section->set(x + 16 * (y % 16) + 16 * 16 * z, t);
+    m_generation++;
+    // The mesh is left as it is. Whoever changes the blocks of a meshed
+    // Chunk brings it up to date, see Terrain::editBlockAt.
 }
 
-const static std::unordered_map<Direction, Direction, EnumHash> oppositeDirection {
-    {XPOS, XNEG},
-    {XNEG, XPOS},
-    {YPOS, YNEG},
-    {YNEG, YPOS},
-    {ZPOS, ZNEG},
-    {ZNEG, ZPOS}
-};
-
 void Chunk::linkNeighbor(uPtr<Chunk> &neighbor, Direction dir) {
     if(neighbor != nullptr) {
         this->m_neighbors[dir] = neighbor.get();
         this->validVBOonCPU = false;
-        neighbor->m_neighbors[oppositeDirection.at(dir)] = this;
+        neighbor->m_neighbors[oppositeDirection(dir)] = this;
         neighbor->validVBOonCPU = false;
     }
 }
 
+Chunk* Chunk::neighbor(Direction dir) const {
+    return m_neighbors[dir];
+}
+
+GenerationStage Chunk::generationStage() const {
+    return m_stage.load(std::memory_order_acquire);
+}
+
+bool Chunk::hasBlockData() const {
+    return generationStage() != NOT_GENERATED;
+}
+
+size_t Chunk::blockMemoryUsage() const {
+    size_t bytes = sizeof(m_sections);
+    for (const auto &section : m_sections) {
+        if (section) bytes += section->memoryUsage();
+    }
+    return bytes;
+}
+
+size_t Chunk::borrowedBlockBytes() const {
+    size_t bytes = 0;
+    for (const auto &section : m_sections) {
+        if (section) bytes += section->borrowedBytes();
+    }
+    return bytes;
+}
+
+size_t Chunk::residentMemoryUsage() const {
+    return blockMemoryUsage() + m_mesh.byteSize()
+           + m_incomingDecorations.capacity() * sizeof(DecorationBlock);
+}
+
+void Chunk::releaseBlockData() {
+    destroyVBOdata();
+    m_mesh = ChunkMesh();
+    for (auto &section : m_sections) {
+        section.reset();
+    }
+    m_surface.reset();
+
+    // Neighbors that were generated again while this Chunk was
+    // resident placed their blocks a second time
+    auto key = [](const DecorationBlock &b) {
+        return std::make_tuple(b.y, b.z, b.x, b.type);
+    };
+    std::sort(m_incomingDecorations.begin(), m_incomingDecorations.end(),
+              [&](const DecorationBlock &a, const DecorationBlock &b) { return key(a) < key(b); });
+    m_incomingDecorations.erase(std::unique(m_incomingDecorations.begin(), m_incomingDecorations.end(),
+                                            [&](const DecorationBlock &a, const DecorationBlock &b) { return key(a) == key(b); }),
+                                m_incomingDecorations.end());
+    m_incomingDecorations.shrink_to_fit();
+
+    m_stage.store(NOT_GENERATED, std::memory_order_release);
+}
+
+SectionKind Chunk::sectionKind(int sy, BlockType *out_type) const {
+    const uPtr<BlockStorage> &section = m_sections.at(sy);
+    BlockType t = EMPTY;
+    if (section && !section->isUniform(&t)) {
+        return MIXED;
+    }
+    if (out_type) *out_type = t;
+    return t == EMPTY ? ALL_AIR : UNIFORM;
+}
+
+// Unsigned LEB128: seven bits per byte, lowest first,
+// with the high bit set on every byte but the last
+static void putVarint(std::vector<unsigned char> &out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<unsigned char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(v));
+}
+
+static bool getVarint(const unsigned char *&p, const unsigned char *end, uint32_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        unsigned char b = *p++;
+        v |= static_cast<uint32_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// A record starts with the GenerationStage its blocks are at: DECORATED, or
+// NOT_GENERATED when it only holds the decoration log. The log follows as a
+// count and five bytes per block, then, for DECORATED, each section as its
+// SectionKind: nothing more for ALL_AIR, the type for UNIFORM, and for MIXED
+// its BlockStorage as it is in memory: the bits per block, the palette size
+// and palette, then zeros up to a multiple of 8 bytes into the record and
+// the packed words, so a Chunk can borrow them from a mapped region file.
+// The words are in the machine's byte order, little-endian everywhere
+// this runs.
+bool Chunk::Snapshot::serialize(std::vector<unsigned char> &out) const {
+    out.clear();
+    bool decorated = stage == DECORATED;
+    if (!decorated && decorations.empty()) {
+        return false;
+    }
+
+    out.push_back(decorated ? DECORATED : NOT_GENERATED);
+    putVarint(out, static_cast<uint32_t>(decorations.size()));
+    for (const DecorationBlock &b : decorations) {
+        out.push_back(b.x);
+        out.push_back(b.z);
+        out.push_back(static_cast<unsigned char>(b.y & 0xff));
+        out.push_back(static_cast<unsigned char>(b.y >> 8));
+        out.push_back(b.type);
+    }
+    if (!decorated) {
+        return true;
+    }
+
+    for (int sy = 0; sy < 16; sy++) {
+        BlockType t = EMPTY;
+        SectionKind kind = MIXED;
+        if (!sections[sy] || sections[sy]->isUniform(&t)) {
+            kind = t == EMPTY ? ALL_AIR : UNIFORM;
+        }
+        out.push_back(kind);
+        if (kind == UNIFORM) {
+            out.push_back(t);
+        } else if (kind == MIXED) {
+            const BlockStorage &section = *sections[sy];
+            const std::vector<BlockType> &palette = section.palette();
+            out.push_back(static_cast<unsigned char>(section.bitsPerBlock()));
+            putVarint(out, static_cast<uint32_t>(palette.size()));
+            out.insert(out.end(), palette.begin(), palette.end());
+            while (out.size() % sizeof(uint64_t) != 0) {
+                out.push_back(0);
+            }
+            const unsigned char *words = reinterpret_cast<const unsigned char*>(section.packedWords());
+            out.insert(out.end(), words, words + sizeof(uint64_t)
+                       * BlockStorage::packedWordCount(section.size(), section.bitsPerBlock()));
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<const Chunk::Snapshot> Chunk::snapshot() const {
+    auto s = std::make_shared<Snapshot>();
+    s->minX = minX;
+    s->minZ = minZ;
+    s->generation = m_generation;
+    // Only the decorations log is saved for Chunks that are not decorated
+    s->stage = generationStage() == DECORATED ? DECORATED : NOT_GENERATED;
+    s->decorations = m_incomingDecorations;
+    if (s->stage == DECORATED) {
+        for (int sy = 0; sy < 16; sy++) {
+            if (m_sections[sy]) s->sections[sy] = mkU<BlockStorage>(*m_sections[sy]);
+        }
+    }
+    return s;
+}
+
+bool Chunk::isDirty() const {
+    return m_generation != m_savedGeneration;
+}
+
+uint64_t Chunk::generation() const {
+    return m_generation;
+}
+
+void Chunk::markSaved(uint64_t generation) {
+    m_savedGeneration = generation;
+}
+
+bool Chunk::deserialize(const unsigned char *data, size_t size, std::shared_ptr<const void> owner) {
+    const unsigned char *p = data, *end = data + size;
+    if (p == end || (*p != DECORATED && *p != NOT_GENERATED)) return false;
+    bool decorated = *p++ == DECORATED;
+
+    uint32_t count;
+    if (!getVarint(p, end, count) || static_cast<size_t>(end - p) / 5 < count) return false;
+    std::vector<DecorationBlock> log;
+    log.reserve(count);
+    for (uint32_t i = 0; i < count; i++, p += 5) {
+        unsigned short y = static_cast<unsigned short>(p[2] | p[3] << 8);
+        if (p[0] >= 16 || p[1] >= 16 || y >= 256) return false;
+        log.push_back(DecorationBlock{p[0], p[1], y, static_cast<BlockType>(p[4])});
+    }
+
+    // Decoded apart, so a malformed record leaves the Chunk as it was
+    std::array<uPtr<BlockStorage>, 16> sections;
+    if (decorated) {
+        for (int sy = 0; sy < 16; sy++) {
+            if (p == end) return false;
+            unsigned char kind = *p++;
+            if (kind == UNIFORM) {
+                if (p == end) return false;
+                sections[sy] = mkU<BlockStorage>(16 * 16 * 16, static_cast<BlockType>(*p++));
+            } else if (kind == MIXED) {
+                if (p == end) return false;
+                unsigned int bits = *p++;
+                uint32_t paletteSize;
+                if (!getVarint(p, end, paletteSize) || paletteSize > 256
+                    || static_cast<size_t>(end - p) < paletteSize) {
+                    return false;
+                }
+                std::vector<BlockType> palette;
+                for (uint32_t i = 0; i < paletteSize; i++) {
+                    palette.push_back(static_cast<BlockType>(*p++));
+                }
+
+                size_t padding = (sizeof(uint64_t) - (p - data) % sizeof(uint64_t)) % sizeof(uint64_t);
+                size_t wordBytes = sizeof(uint64_t) * BlockStorage::packedWordCount(16 * 16 * 16, bits);
+                if (static_cast<size_t>(end - p) < padding + wordBytes) return false;
+                p += padding;
+                if (owner && reinterpret_cast<uintptr_t>(p) % alignof(uint64_t) == 0) {
+                    sections[sy] = BlockStorage::fromPacked(16 * 16 * 16, bits, palette,
+                                                            reinterpret_cast<const uint64_t*>(p), owner);
+                } else {
+                    std::vector<uint64_t> words(wordBytes / sizeof(uint64_t));
+                    std::memcpy(words.data(), p, wordBytes);
+                    sections[sy] = BlockStorage::fromPacked(16 * 16 * 16, bits, palette, words.data());
+                }
+                if (!sections[sy]) return false;
+                p += wordBytes;
+            } else if (kind != ALL_AIR) {
+                return false;
+            }
+        }
+    }
+    if (p != end) return false;
+
+    // Blocks neighbors placed while this Chunk was not resident may be
+    // missing from the record; the ones it has are already in its blocks
+    auto key = [](const DecorationBlock &b) {
+        return std::make_tuple(b.y, b.z, b.x, b.type);
+    };
+    auto less = [&](const DecorationBlock &a, const DecorationBlock &b) { return key(a) < key(b); };
+    std::vector<DecorationBlock> sorted = log;
+    std::sort(sorted.begin(), sorted.end(), less);
+    std::vector<DecorationBlock> unsaved;
+    for (const DecorationBlock &b : m_incomingDecorations) {
+        if (!std::binary_search(sorted.begin(), sorted.end(), b, less)) {
+            unsaved.push_back(b);
+        }
+    }
+
+    m_incomingDecorations = std::move(log);
+    m_incomingDecorations.insert(m_incomingDecorations.end(), unsaved.begin(), unsaved.end());
+    // Up to date with the record, apart from the blocks it was missing
+    m_generation++;
+    m_savedGeneration = unsaved.empty() ? m_generation : 0;
+    if (!decorated) {
+        return true;
+    }
+
+    m_sections = std::move(sections);
+    m_surface.reset();
+    validVBOonCPU = false;
+    for (const DecorationBlock &b : unsaved) {
+        receiveDecoration(b.x, b.y, b.z, b.type);
+    }
+    m_stage.store(DECORATED, std::memory_order_release);
+    return true;
+}
+
+void Chunk::releaseEmptySections() {
+    for (auto &section : m_sections) {
+        if (section && section->count(EMPTY) == section->size()) {
+            section.reset();
+        }
+    }
+}
+
+CaveSampling Chunk::s_caveSampling = CAVES_TRILINEAR;
+
+void Chunk::setCaveSampling(CaveSampling sampling) {
+    s_caveSampling = sampling;
+}
+
+CaveSampling Chunk::caveSampling() {
+    return s_caveSampling;
+}
+
 void Chunk::generateChunk(int x_off, int z_off) {
+    generateChunk(x_off, z_off, s_caveSampling);
+}
+
+void Chunk::generateChunk(int x_off, int z_off, CaveSampling caveSampling) {
+    generateBaseTerrain(x_off, z_off, caveSampling);
+    decorate();
+}
+
+void Chunk::generateBaseTerrain(int x_off, int z_off, CaveSampling caveSampling) {
+    m_surface = mkU<std::array<ColumnSurface, 16 * 16>>();
+    CaveNoise caves(glm::ivec2(x_off, z_off), caveSampling);
+    for(int x = 0; x < 16; x++) {
+        for(int z = 0; z < 16; z++) {
+            generateBlock(x, z, x_off, z_off, caves);
+        }
+    }
+    releaseEmptySections();
+    m_stage.store(BASE_TERRAIN, std::memory_order_release);
+}
+
+void Chunk::decorate() {
     for(int x = 0; x < 16; x++) {
         for(int z = 0; z < 16; z++) {
-            generateBlock(x, z, x_off, z_off);
+            decorateColumn(x, z);
         }
     }
+    m_surface.reset();
+
+    for (const DecorationBlock &b : m_incomingDecorations) {
+        receiveDecoration(b.x, b.y, b.z, b.type);
+    }
+    m_stage.store(DECORATED, std::memory_order_release);
 }
 
+// Which of two plant blocks wins when plants of different Chunks overlap:
+// trunks and stems over leaves, then the higher BlockType. 0 for blocks
+// plants never place.
+static int decorationRank(BlockType t) {
+    switch (t) {
+    case OAK_LEAF: case DARK_LEAF: case BIRCH_LEAF: case MUSHHEAD:
+        return 1;
+    case OAK_LOG: case DARK_LOG: case BIRCH_LOG: case MUSHSTEM:
+    case CACTUS: case PUMPKIN: case WATERMELON: case LATERN:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+void Chunk::placeDecoration(int x, int y, int z, BlockType t) {
+    if (y < 0 || y >= 256) return;
+
+    Chunk *c = this;
+    if (x < 0) {
+        c = c->m_neighbors[XNEG];
+        x += 16;
+    } else if (x >= 16) {
+        c = c->m_neighbors[XPOS];
+        x -= 16;
+    }
+    if (c && z < 0) {
+        c = c->m_neighbors[ZNEG];
+        z += 16;
+    } else if (c && z >= 16) {
+        c = c->m_neighbors[ZPOS];
+        z -= 16;
+    }
+
+    if (c == this) {
+        setBlockAt(static_cast<unsigned int>(x), static_cast<unsigned int>(y), static_cast<unsigned int>(z), t);
+    } else if (c) {
+        c->m_incomingDecorations.push_back(DecorationBlock{
+            static_cast<unsigned char>(x), static_cast<unsigned char>(z),
+            static_cast<unsigned short>(y), t});
+        c->m_generation++;
+        if (c->generationStage() == DECORATED) {
+            c->receiveDecoration(x, y, z, t);
+        }
+    }
+}
+
+// Only fills EMPTY blocks and plant blocks of lower rank, so the result
+// is the same whichever order neighbors are decorated in
+void Chunk::receiveDecoration(int x, int y, int z, BlockType t) {
+    unsigned int ux = static_cast<unsigned int>(x);
+    unsigned int uy = static_cast<unsigned int>(y);
+    unsigned int uz = static_cast<unsigned int>(z);
+    BlockType current = getBlockAt(ux, uy, uz);
+    int rank = decorationRank(t), currentRank = decorationRank(current);
+    if (current == EMPTY
+        || (currentRank > 0 && (rank > currentRank || (rank == currentRank && t > current)))) {
+        setBlockAt(ux, uy, uz, t);
+    }
+}
+
+// Only looks inside this Chunk, since its neighbors may still be generating
 bool Chunk::isCaveBlockInWater(int x, int y, int z) {
     if (getBlockAt(x, 129, z) == WATER) return true;
     if (getBlockAt(x, y+1, z) == WATER) return true;
@@ -107,14 +468,14 @@ void Chunk::plantATree(int x, int h, int z, int type) {
     }
     // Build the trunk
     for (int i = 0; i < 5; i++) {
-        setBlockAt(x, h + i, z, log);
+        placeDecoration(x, h + i, z, log);
     }
 
     // Top layer of leaves
     for (int dx = -1; dx <= 1; dx++) {
         for (int dz = -1; dz <= 1; dz++) {
             if (dx != 0 || dz != 0) { // Avoid placing a leaf block directly above the top log
-                setBlockAt(x + dx, h + 5, z + dz, leaf);
+                placeDecoration(x + dx, h + 5, z + dz, leaf);
             }
         }
     }
@@ -122,7 +483,7 @@ void Chunk::plantATree(int x, int h, int z, int type) {
     // Second layer of leaves
     for (int dx = -1; dx <= 1; dx++) {
         for (int dz = -1; dz <= 1; dz++) {
-            setBlockAt(x + dx, h + 4, z + dz, leaf);
+            placeDecoration(x + dx, h + 4, z + dz, leaf);
         }
     }
 
@@ -130,44 +491,36 @@ void Chunk::plantATree(int x, int h, int z, int type) {
     for (int dx = -2; dx <= 2; dx++) {
         for (int dz = -2; dz <= 2; dz++) {
             if (abs(dx) != 2 || abs(dz) != 2) {
-                setBlockAt(x + dx, h + 3, z + dz, leaf);
+                placeDecoration(x + dx, h + 3, z + dz, leaf);
             }
         }
     }
 
     // Fourth layer of leaves - just the corners
-    setBlockAt(x - 2, h + 2, z - 2, leaf);
-    setBlockAt(x - 2, h + 2, z + 2, leaf);
-    setBlockAt(x + 2, h + 2, z - 2, leaf);
-    setBlockAt(x + 2, h + 2, z + 2, leaf);
+    placeDecoration(x - 2, h + 2, z - 2, leaf);
+    placeDecoration(x - 2, h + 2, z + 2, leaf);
+    placeDecoration(x + 2, h + 2, z - 2, leaf);
+    placeDecoration(x + 2, h + 2, z + 2, leaf);
 
     // Add random leaves around the tree
     // for (int i = 0; i < numberOfRandomLeaves; i++) {
     //     int randomDx = random.nextInt(5) - 2; // Random offset between -2 and 2
     //     int randomDz = random.nextInt(5) - 2;
-    //     setBlockAt(x + randomDx, h + 2, z + randomDz, OAK_LEAF);
+    //     placeDecoration(x + randomDx, h + 2, z + randomDz, OAK_LEAF);
     // }
 }
 
-void Chunk::generateBlock(int x, int z, int x_off, int z_off) {
+void Chunk::generateBlock(int x, int z, int x_off, int z_off, const CaveNoise &caves) {
     int x_world = x + x_off;
     int z_world = z + z_off;
 
-    float weirdness = SimplexNoise(randomizeUV(glm::vec2(x_world, z_world), 0.25f, 200.f));
-    float humidity = SimplexNoise(randomizeUV(glm::vec2(x_world, z_world), 0.33f, 128.f));
+    TerrainSample sample = sampleTerrain(glm::vec2(x_world, z_world));
+    float weirdness = sample.weirdness;
+    float humidity = sample.humidity;
 
     BiomeType currentBiome;
 
-    weirdness = weirdness * 0.5f + 0.5f;
-    weirdness = glm::smoothstep(0.05f, 0.75f, weirdness);
-
-    humidity = humidity * 0.5f + 0.5f;
-    humidity = glm::smoothstep(0.1f, 0.8f, humidity);
-
-    float grassH= midHeight(glm::vec2(x_world, z_world));
-    float mountainH= peakHeight(glm::vec2(x_world, z_world));
-    float desertH= lowHeight(glm::vec2(x_world, z_world));
-    int h = int(glm::mix(mountainH, glm::mix(desertH, grassH, humidity), weirdness)) + 128;
+    int h = int(glm::mix(sample.peak, glm::mix(sample.low, sample.mid, humidity), weirdness)) + 128;
 
     // Bedrock
     setBlockAt(x, 0, z, BEDROCK);
@@ -235,9 +588,8 @@ void Chunk::generateBlock(int x, int z, int x_off, int z_off) {
     }
 
     // Cave
-    for (int y = 128; y >= 1; y--) {
-        glm::vec3 pos(x_world, y, z_world);
-        float p = SimplexNoise(pos / 32.f) * 0.5f + 0.5f;
+    for (int y = CAVE_MAX_Y; y >= 1; y--) {
+        float p = caves.at(x, y, z) * 0.5f + 0.5f;
         if (p < 0.25f) {
             if (y <= 24) {
                 setBlockAt(x, y, z, LAVA);
@@ -252,8 +604,23 @@ void Chunk::generateBlock(int x, int z, int x_off, int z_off) {
         }
     }
 
+    (*m_surface)[x + 16 * z] = ColumnSurface{static_cast<short>(h), currentBiome};
+}
+
+void Chunk::decorateColumn(int x, int z) {
+    int x_world = x + minX;
+    int z_world = z + minZ;
+    const ColumnSurface &surface = (*m_surface)[x + 16 * z];
+    int h = surface.height;
+    BiomeType currentBiome = surface.biome;
+
     // Plants
-    float density = (float) rand()/RAND_MAX;
+    // Each decision draws the next number of this column's random sequence
+    uint32_t draws = 0;
+    auto nextRandom = [&]() {
+        return columnRandom(glm::ivec2(x_world, z_world), draws++);
+    };
+    float density = nextRandom();
 
     if (currentBiome == DESERT) {
         if (density > 0.9875f && getBlockAt(x, h, z) == EMPTY) {
@@ -264,73 +631,60 @@ void Chunk::generateBlock(int x, int z, int x_off, int z_off) {
     }
 
     else if (currentBiome == MARSH) {
-        if (x + 1 >= 16 || x - 1 < 0 || z + 1 >= 16 || z - 1 < 0) {}
-        else {
-            density = (float) rand()/RAND_MAX;
-            if (density > 0.9875f && getBlockAt(x, h + 2, z) == EMPTY) {
-                setBlockAt(x, h, z, MUSHSTEM);
-                setBlockAt(x, h+1, z, MUSHSTEM);
-                setBlockAt(x, h+2, z, MUSHSTEM);
-                setBlockAt(x, h+3, z, MUSHSTEM);
-
-                setBlockAt(x, h+4, z, MUSHHEAD);
-
-                // Should check boundary
-                setBlockAt(x-1, h+4, z, MUSHHEAD);
-                setBlockAt(x+1, h+4, z, MUSHHEAD);
-                setBlockAt(x, h+4, z-1, MUSHHEAD);
-                setBlockAt(x, h+4, z+1, MUSHHEAD);
-                setBlockAt(x-1, h+4, z-1, MUSHHEAD);
-                setBlockAt(x-1, h+4, z+1, MUSHHEAD);
-                setBlockAt(x+1, h+4, z-1, MUSHHEAD);
-                setBlockAt(x+1, h+4, z+1, MUSHHEAD);
-            }
+        density = nextRandom();
+        if (density > 0.9875f && getBlockAt(x, h + 2, z) == EMPTY) {
+            placeDecoration(x, h, z, MUSHSTEM);
+            placeDecoration(x, h+1, z, MUSHSTEM);
+            placeDecoration(x, h+2, z, MUSHSTEM);
+            placeDecoration(x, h+3, z, MUSHSTEM);
+
+            placeDecoration(x, h+4, z, MUSHHEAD);
+
+            placeDecoration(x-1, h+4, z, MUSHHEAD);
+            placeDecoration(x+1, h+4, z, MUSHHEAD);
+            placeDecoration(x, h+4, z-1, MUSHHEAD);
+            placeDecoration(x, h+4, z+1, MUSHHEAD);
+            placeDecoration(x-1, h+4, z-1, MUSHHEAD);
+            placeDecoration(x-1, h+4, z+1, MUSHHEAD);
+            placeDecoration(x+1, h+4, z-1, MUSHHEAD);
+            placeDecoration(x+1, h+4, z+1, MUSHHEAD);
         }
     }
 
     else if (currentBiome == OAK_FOREST) {
-        if (x + 2 >= 16 || x - 2 < 0 || z + 2 >= 16 || z - 2 < 0) {}
-        else {
-            density = (float) rand()/RAND_MAX;
-            if (density > 0.99f && getBlockAt(x, h + 4, z) == EMPTY && getBlockAt(x, h - 1, z) != SAND) {
-                plantATree(x, h, z, 0);
-            }
+        density = nextRandom();
+        if (density > 0.99f && getBlockAt(x, h + 4, z) == EMPTY && getBlockAt(x, h - 1, z) != SAND) {
+            plantATree(x, h, z, 0);
         }
     }
 
     else if (currentBiome == DARK_FOREST) {
-        if (x + 2 >= 16 || x - 2 < 0 || z + 2 >= 16 || z - 2 < 0) {}
-        else {
-            density = (float) rand()/RAND_MAX;
-            if (density > 0.95f && getBlockAt(x, h + 4, z) == EMPTY && getBlockAt(x, h - 1, z) != SAND) {
-                plantATree(x, h, z, 1);
-            }
-            density = (float) rand()/RAND_MAX;
-            if (density > 0.99f && getBlockAt(x, h, z) == EMPTY && getBlockAt(x, h - 1, z) != SAND) {
-                setBlockAt(x, h, z, PUMPKIN);
-            }
+        density = nextRandom();
+        if (density > 0.95f && getBlockAt(x, h + 4, z) == EMPTY && getBlockAt(x, h - 1, z) != SAND) {
+            plantATree(x, h, z, 1);
+        }
+        density = nextRandom();
+        if (density > 0.99f && getBlockAt(x, h, z) == EMPTY && getBlockAt(x, h - 1, z) != SAND) {
+            setBlockAt(x, h, z, PUMPKIN);
         }
     }
 
     else if (currentBiome == BIRCH_FOREST) {
-        if (x + 2 >= 16 || x - 2 < 0 || z + 2 >= 16 || z - 2 < 0) {}
-        else {
-            density = (float) rand()/RAND_MAX;
-            if (density > 0.99f && getBlockAt(x, h + 4, z) == EMPTY) {
-                plantATree(x, h, z, 2);
-            }
+        density = nextRandom();
+        if (density > 0.99f && getBlockAt(x, h + 4, z) == EMPTY) {
+            plantATree(x, h, z, 2);
         }
     }
 
     else if (currentBiome == SNOWPEAK) {
-        density = (float) rand()/RAND_MAX;
+        density = nextRandom();
         if (density > 0.9975f && getBlockAt(x, h, z) == EMPTY) {
             setBlockAt(x, h, z, LATERN);
         }
     }
 
     else if (currentBiome == PLAIN) {
-        density = (float) rand()/RAND_MAX;
+        density = nextRandom();
         if (density > 0.9995f && getBlockAt(x, h, z) == EMPTY) {
             setBlockAt(x, h, z, WATERMELON);
         }
@@ -342,51 +696,45 @@ void Chunk::generateBlock(int x, int z, int x_off, int z_off) {
 // VBO Generation -------------------------------------------------------------
 // ----------------------------------------------------------------------------
 
+// The in-tile texture coordinates of a face are derived from its world
+// position in lambert.frag.glsl, so a quad only carries its tile in the
+// texture atlas. This lets a merged quad repeat the texture.
 struct BlockFace {
     Direction dir;
-    std::array<glm::vec3, 4> pos;
-    glm::vec3 nor;
-    std::array<glm::vec2, 4> uv;
+    std::array<glm::ivec3, 4> pos;
+    glm::ivec3 nor;
 };
 
-constexpr float UV = 1/16.f;
-
 const static std::array<BlockFace, 6> neighboringFaces {
     BlockFace{
         XPOS,
-        {glm::vec3{1, 0, 0}, glm::vec3{1, 1, 0}, glm::vec3{1, 1, 1}, glm::vec3{1, 0, 1}},
-        glm::vec3{1, 0, 0},
-        {glm::vec2{UV, 0}, glm::vec2{UV, UV}, glm::vec2{0, UV}, glm::vec2{0, 0}}
+        {glm::ivec3{1, 0, 0}, glm::ivec3{1, 1, 0}, glm::ivec3{1, 1, 1}, glm::ivec3{1, 0, 1}},
+        glm::ivec3{1, 0, 0}
     },
     BlockFace{
         XNEG,
-        {glm::vec3{0, 0, 0}, glm::vec3{0, 0, 1}, glm::vec3{0, 1, 1}, glm::vec3{0, 1, 0}},
-        glm::vec3{-1, 0, 0},
-        {glm::vec2{0, 0}, glm::vec2{UV, 0}, glm::vec2{UV, UV}, glm::vec2{0, UV}}
+        {glm::ivec3{0, 0, 0}, glm::ivec3{0, 0, 1}, glm::ivec3{0, 1, 1}, glm::ivec3{0, 1, 0}},
+        glm::ivec3{-1, 0, 0}
     },
     BlockFace{
         YPOS,
-        {glm::vec3{0, 1, 0}, glm::vec3{1, 1, 0}, glm::vec3{1, 1, 1}, glm::vec3{0, 1, 1}},
-        glm::vec3{0, 1, 0},
-        {glm::vec2{0, UV}, glm::vec2{UV, UV}, glm::vec2{UV, 0}, glm::vec2{0, 0}}
+        {glm::ivec3{0, 1, 0}, glm::ivec3{1, 1, 0}, glm::ivec3{1, 1, 1}, glm::ivec3{0, 1, 1}},
+        glm::ivec3{0, 1, 0}
     },
     BlockFace{
         YNEG,
-        {glm::vec3{0, 0, 0}, glm::vec3{0, 0, 1}, glm::vec3{1, 0, 1}, glm::vec3{1, 0, 0}},
-        glm::vec3{0, -1, 0},
-        {glm::vec2{0, 0}, glm::vec2{0, UV}, glm::vec2{UV, UV}, glm::vec2{UV, 0}}
+        {glm::ivec3{0, 0, 0}, glm::ivec3{0, 0, 1}, glm::ivec3{1, 0, 1}, glm::ivec3{1, 0, 0}},
+        glm::ivec3{0, -1, 0}
     },
     BlockFace{
         ZPOS,
-        {glm::vec3{0, 0, 1}, glm::vec3{1, 0, 1}, glm::vec3{1, 1, 1}, glm::vec3{0, 1, 1}},
-        glm::vec3{0, 0, 1},
-        {glm::vec2{0, 0}, glm::vec2{UV, 0}, glm::vec2{UV, UV}, glm::vec2{0, UV}}
+        {glm::ivec3{0, 0, 1}, glm::ivec3{1, 0, 1}, glm::ivec3{1, 1, 1}, glm::ivec3{0, 1, 1}},
+        glm::ivec3{0, 0, 1}
     },
     BlockFace{
         ZNEG,
-        {glm::vec3{0, 0, 0}, glm::vec3{0, 1, 0}, glm::vec3{1, 1, 0}, glm::vec3{1, 0, 0}},
-        glm::vec3{0, 0, -1},
-        {glm::vec2{UV, 0}, glm::vec2{UV, UV}, glm::vec2{0, UV}, glm::vec2{0, 0}}
+        {glm::ivec3{0, 0, 0}, glm::ivec3{0, 1, 0}, glm::ivec3{1, 1, 0}, glm::ivec3{1, 0, 0}},
+        glm::ivec3{0, 0, -1}
     }
 };
 
@@ -565,88 +913,512 @@ inline bool isTransparent(BlockType t) {
     return t == WATER || t == LAVA;
 }
 
-void Chunk::createVBOdata() {
-    // use cached VBO data if possible
-    if (validVBOonCPU) return;
+MeshingMode Chunk::s_meshingMode = PER_FACE;
+
+void Chunk::setMeshingMode(MeshingMode mode) {
+    s_meshingMode = mode;
+}
+
+MeshingMode Chunk::meshingMode() {
+    return s_meshingMode;
+}
 
-    idxOpaque.clear();
+void ChunkMesh::clear() {
     vboOpaque.clear();
-    idxTransparent.clear();
     vboTransparent.clear();
+    opaqueSlots.fill(SectionSlots());
+    transparentSlots.fill(SectionSlots());
+}
+
+size_t ChunkMesh::vertexCount() const {
+    size_t quads = 0;
+    for (int sy = 0; sy < 16; sy++) {
+        quads += opaqueSlots[sy].count + transparentSlots[sy].count;
+    }
+    return 4 * quads;
+}
+
+size_t ChunkMesh::byteSize() const {
+    return (vboOpaque.size() + vboTransparent.size()) * sizeof(Vertex);
+}
+
+// Is the face of curr that points towards neighbor visible?
+inline bool isFaceVisible(BlockType curr, BlockType neighbor) {
+    if (curr == EMPTY || curr == neighbor) return false;
+    return neighbor == EMPTY || isTransparent(neighbor);
+}
+
+// Appends one quad covering size.x * size.y * size.z blocks,
+// whose minimum corner is at the chunk-local origin, to the given mesh
+static void appendQuad(ChunkMesh &mesh, BlockType t, const BlockFace &bf,
+                       glm::ivec3 origin, glm::ivec3 size) {
+    auto& vbo = isTransparent(t) ? mesh.vboTransparent : mesh.vboOpaque;
+
+    glm::ivec2 tile(blockFaceUVs.at(t).at(bf.dir) * 16.f + 0.5f);
+    for (int i = 0; i < 4; i++) {
+        vbo.emplace_back(origin + bf.pos[i] * size, bf.dir, tile);
+    }
+}
+
+// Fills spare slots. All four corners coincide, so
+// both triangles are degenerate and draw nothing.
+static const Vertex degenerateVertex(glm::ivec3(0), XPOS, glm::ivec2(0));
+
+// The slots given to a section of the given number of quads
+static uint32_t slotCapacity(uint32_t quads) {
+    return quads == 0 ? 0 : quads + quads / 8 + 4;
+}
+
+// Gives the quads appended to the pass since slot first to section sy,
+// padded with spare slots
+static void closeSection(std::vector<Vertex> &vbo, std::array<SectionSlots, 16> &sections,
+                         int sy, uint32_t first) {
+    SectionSlots &s = sections[sy];
+    s.first = first;
+    s.count = vbo.size() / 4 - first;
+    s.capacity = slotCapacity(s.count);
+    vbo.insert(vbo.end(), 4 * (s.capacity - s.count), degenerateVertex);
+}
+
+// Writes the quads section sy was meshed into over its slots, moving the
+// sections above it up if they do not fit. Returns whether they were moved.
+static bool patchSection(std::vector<Vertex> &vbo, std::array<SectionSlots, 16> &sections,
+                         int sy, const std::vector<Vertex> &quads) {
+    SectionSlots &s = sections[sy];
+    uint32_t count = quads.size() / 4;
+    bool moved = count > s.capacity;
+    if (moved) {
+        uint32_t capacity = slotCapacity(count);
+        uint32_t extra = capacity - s.capacity;
+        vbo.insert(vbo.begin() + 4 * (s.first + s.capacity), 4 * extra, degenerateVertex);
+        for (int i = sy + 1; i < 16; i++) {
+            sections[i].first += extra;
+        }
+        s.capacity = capacity;
+    }
+    auto out = vbo.begin() + 4 * s.first;
+    std::copy(quads.begin(), quads.end(), out);
+    std::fill(out + quads.size(), out + 4 * s.capacity, degenerateVertex);
+    s.count = count;
+    return moved;
+}
+
+// A section can be skipped if it is all air, since only non-EMPTY blocks
+// emit faces, or if it is all one type and every neighbouring section is
+// uniform too with no face of that type visible against it.
+bool Chunk::canSkipSection(const ChunkView &view, int sy) const {
+    BlockType t;
+    SectionKind kind = sectionKind(sy, &t);
+    if (kind != UNIFORM) return kind == ALL_AIR;
+
+    for (auto& bf : neighboringFaces) {
+        BlockType neighbor;
+        if (bf.dir == YPOS && sy == 15) {
+            neighbor = EMPTY;
+        } else if (bf.dir == YNEG && sy == 0) {
+            neighbor = UNKNOWN;
+        } else if (bf.dir == YPOS || bf.dir == YNEG) {
+            if (sectionKind(sy + bf.nor.y, &neighbor) == MIXED) return false;
+        } else if (view.neighborSectionKind(bf.dir, sy, &neighbor) == MIXED) {
+            return false;
+        }
+        if (isFaceVisible(t, neighbor)) return false;
+    }
+    return true;
+}
+
+// Index of the lowest set bit of a non-zero mask
+inline int lowestBit(uint32_t bits) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, bits);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctz(bits);
+#endif
+}
 
-    for (int z = 0; z < 16; z++) {
-        for (int y = 0; y < 256; y++) {
-            for (int x = 0; x < 16; x++) {
+// Which blocks of a section and of the one-block border around it are
+// EMPTY, WATER or LAVA, kept as one bitmask per (y, z) row. Rows are
+// indexed [y + 1][z + 1] and block x is bit x + 1, so -1 and 16 address
+// the border. Any other block, including UNKNOWN ones outside the
+// loaded world, is opaque.
+struct OccupancyMasks {
+    std::array<std::array<uint32_t, 18>, 18> empty, water, lava;
+};
 
-                BlockType curr = getBlockAt(x, y, z);
-                if (curr == EMPTY) continue;
+// The visible faces of a section: for every Direction, one mask per
+// (y, z) row, indexed y * 16 + z, where bit x is set if the face of
+// block x points at a block it is visible against.
+struct SectionFaces {
+    std::array<std::array<uint16_t, 16 * 16>, 6> rows;
+};
 
-                glm::vec3 blockWorldPos(x + minX, y, z + minZ);
+void Chunk::computeVisibleFaces(const ChunkView &view, int sy, SectionFaces &faces) const {
+    OccupancyMasks m {};
+
+    auto mark = [&m](BlockType t, int y, int z, uint32_t bit) {
+        if (t == EMPTY) m.empty[y + 1][z + 1] |= bit;
+        else if (t == WATER) m.water[y + 1][z + 1] |= bit;
+        else if (t == LAVA) m.lava[y + 1][z + 1] |= bit;
+    };
+
+    // The section itself, whole rows at a time where it is uniform
+    BlockType uniform;
+    if (sectionKind(sy, &uniform) != MIXED) {
+        for (int y = 0; y < 16; y++) {
+            for (int z = 0; z < 16; z++) {
+                mark(uniform, y, z, 0xffffu << 1);
+            }
+        }
+    } else {
+        const BlockStorage &section = *m_sections[sy];
+        for (int y = 0; y < 16; y++) {
+            for (int z = 0; z < 16; z++) {
+                for (int x = 0; x < 16; x++) {
+                    mark(section.get(x + 16 * y + 16 * 16 * z), y, z, 1u << (x + 1));
+                }
+            }
+        }
+    }
 
-                for (auto& bf : neighboringFaces) {
+    // The border, copied from the sections above and below and from
+    // the view's copy of the neighbouring Chunks. Edges and corners
+    // are never looked at.
+    int y0 = 16 * sy;
+    for (int a = 0; a < 16; a++) {
+        for (int b = 0; b < 16; b++) {
+            // a = x, b = z
+            mark(view.getBlockAt(a, y0 - 1, b), -1, b, 1u << (a + 1));
+            mark(view.getBlockAt(a, y0 + 16, b), 16, b, 1u << (a + 1));
+            // a = y, b = x or z
+            mark(view.getBlockAt(b, y0 + a, -1), a, -1, 1u << (b + 1));
+            mark(view.getBlockAt(b, y0 + a, 16), a, 16, 1u << (b + 1));
+            mark(view.getBlockAt(-1, y0 + a, b), a, b, 1u);
+            mark(view.getBlockAt(16, y0 + a, b), a, b, 1u << 17);
+        }
+    }
 
-                    BlockType neighbor = getBlockAt(x + int(bf.nor.x), y + int(bf.nor.y), z + int(bf.nor.z));
+    // A face is visible if an opaque block faces an EMPTY or transparent
+    // one, or a transparent block faces EMPTY or the other liquid.
+    // This is isFaceVisible, evaluated on 18 blocks at once.
+    for (auto& bf : neighboringFaces) {
+        auto &out = faces.rows[bf.dir];
+        for (int y = 0; y < 16; y++) {
+            for (int z = 0; z < 16; z++) {
+                int ny = y + 1 + bf.nor.y;
+                int nz = z + 1 + bf.nor.z;
+                uint32_t e = m.empty[ny][nz];
+                uint32_t w = m.water[ny][nz];
+                uint32_t l = m.lava[ny][nz];
+                if (bf.nor.x > 0) {
+                    e >>= 1; w >>= 1; l >>= 1;
+                } else if (bf.nor.x < 0) {
+                    e <<= 1; w <<= 1; l <<= 1;
+                }
 
-                    if (curr == neighbor) continue;
+                uint32_t ce = m.empty[y + 1][z + 1];
+                uint32_t cw = m.water[y + 1][z + 1];
+                uint32_t cl = m.lava[y + 1][z + 1];
+                uint32_t opaque = ~(ce | cw | cl);
 
-                    if (neighbor == EMPTY || isTransparent(neighbor)) {
-                        auto& idx = isTransparent(curr) ? idxTransparent : idxOpaque;
-                        auto& vbo = isTransparent(curr) ? vboTransparent : vboOpaque;
+                uint32_t visible = (opaque & (e | w | l)) | (cw & (e | l)) | (cl & (e | w));
+                out[y * 16 + z] = static_cast<uint16_t>(visible >> 1);
+            }
+        }
+    }
+}
+
+void Chunk::buildSectionPerFace(const SectionFaces &faces, int sy, ChunkMesh &mesh) const {
+    for (auto& bf : neighboringFaces) {
+        const auto &rows = faces.rows[bf.dir];
+        for (int y = 0; y < 16; y++) {
+            for (int z = 0; z < 16; z++) {
+                uint32_t bits = rows[y * 16 + z];
+                // Only the set bits turn into quads
+                while (bits) {
+                    int x = lowestBit(bits);
+                    bits &= bits - 1;
+                    BlockType curr = getBlockAt(x, 16 * sy + y, z);
+                    appendQuad(mesh, curr, bf, glm::ivec3(x, 16 * sy + y, z), glm::ivec3(1));
+                }
+            }
+        }
+    }
+}
+
+// Greedy meshing: every slice of a section perpendicular to a face's normal
+// is turned into a 2D mask of the block types whose face is visible, and
+// runs of equal types in the mask are grown into maximal rectangles.
+void Chunk::buildSectionGreedy(const SectionFaces &faces, int sy, ChunkMesh &mesh) const {
+    const int dim = 16;
+    std::array<BlockType, dim * dim> mask;
+    const glm::ivec3 base(0, 16 * sy, 0);
+
+    for (auto& bf : neighboringFaces) {
+        // d is the axis of the normal, u and v span the slice
+        int d = bf.nor.x != 0 ? 0 : (bf.nor.y != 0 ? 1 : 2);
+        int u = (d + 1) % 3;
+        int v = (d + 2) % 3;
+        const auto &rows = faces.rows[bf.dir];
+
+        for (int s = 0; s < dim; s++) {
+            // Build the mask of visible faces in this slice,
+            // only looking up the type where a face is visible
+            glm::ivec3 p;
+            p[d] = s;
+            for (int b = 0; b < dim; b++) {
+                p[v] = b;
+                for (int a = 0; a < dim; a++) {
+                    p[u] = a;
+                    bool visible = (rows[p.y * 16 + p.z] >> p.x) & 1;
+                    glm::ivec3 q = base + p;
+                    mask[a + b * dim] = visible ? getBlockAt(q.x, q.y, q.z) : EMPTY;
+                }
+            }
+
+            // Merge equal neighbouring entries into rectangles
+            for (int b = 0; b < dim; b++) {
+                for (int a = 0; a < dim;) {
+                    BlockType t = mask[a + b * dim];
+                    if (t == EMPTY) {
+                        a++;
+                        continue;
+                    }
 
-                        int startIdx = vbo.size();
-                        for (int i = 0; i < 4; i++) {
-                            vbo.emplace_back(blockWorldPos + bf.pos[i], bf.nor, blockFaceUVs.at(curr).at(bf.dir) + bf.uv[i]);
+                    int w = 1;
+                    while (a + w < dim && mask[a + w + b * dim] == t) {
+                        w++;
+                    }
+
+                    int h = 1;
+                    bool rowMatches = true;
+                    while (b + h < dim && rowMatches) {
+                        for (int k = 0; k < w; k++) {
+                            if (mask[a + k + (b + h) * dim] != t) {
+                                rowMatches = false;
+                                break;
+                            }
                         }
-                        idx.push_back(startIdx);
-                        idx.push_back(startIdx + 1);
-                        idx.push_back(startIdx + 2);
-                        idx.push_back(startIdx);
-                        idx.push_back(startIdx + 2);
-                        idx.push_back(startIdx + 3);
+                        if (rowMatches) h++;
+                    }
+
+                    glm::ivec3 origin;
+                    origin[d] = s;
+                    origin[u] = a;
+                    origin[v] = b;
+                    glm::ivec3 size(1);
+                    size[u] = w;
+                    size[v] = h;
+                    appendQuad(mesh, t, bf, base + origin, size);
+
+                    for (int j = 0; j < h; j++) {
+                        std::fill_n(mask.begin() + a + (b + j) * dim, w, EMPTY);
                     }
+                    a += w;
                 }
+            }
+        }
+    }
+}
 
+void Chunk::buildMesh(const ChunkView &view, MeshingMode mode, ChunkMesh &mesh) const {
+    mesh.clear();
+    SectionFaces faces;
+
+    for (int sy = 0; sy < 16; sy++) {
+        uint32_t opaqueFirst = mesh.vboOpaque.size() / 4;
+        uint32_t transparentFirst = mesh.vboTransparent.size() / 4;
+        if (!canSkipSection(view, sy)) {
+            computeVisibleFaces(view, sy, faces);
+            if (mode == GREEDY) {
+                buildSectionGreedy(faces, sy, mesh);
+            } else {
+                buildSectionPerFace(faces, sy, mesh);
             }
         }
+        closeSection(mesh.vboOpaque, mesh.opaqueSlots, sy, opaqueFirst);
+        closeSection(mesh.vboTransparent, mesh.transparentSlots, sy, transparentFirst);
+    }
+}
+
+bool Chunk::remeshSection(int sy) {
+    if (!validVBOonCPU) return false;
+
+    // Only the neighbors' blocks along this section are copied
+    ChunkView view(this, sy, sy);
+    ChunkMesh section;
+    if (!canSkipSection(view, sy)) {
+        SectionFaces faces;
+        computeVisibleFaces(view, sy, faces);
+        if (s_meshingMode == GREEDY) {
+            buildSectionGreedy(faces, sy, section);
+        } else {
+            buildSectionPerFace(faces, sy, section);
+        }
+    }
+
+    // The patched section's quads are no longer sorted
+    if (m_mesh.transparentSlots[sy].count > 0 || !section.vboTransparent.empty()) {
+        transparentChanged();
     }
+    bool opaqueMoved = patchSection(m_mesh.vboOpaque, m_mesh.opaqueSlots, sy, section.vboOpaque);
+    bool transparentMoved = patchSection(m_mesh.vboTransparent, m_mesh.transparentSlots,
+                                         sy, section.vboTransparent);
+    // Not uploaded yet, sendVBOdata will send all of it
+    if (!validVBOonGPU) return true;
+
+    uploadSlots(false, m_mesh.opaqueSlots[sy], opaqueMoved);
+    uploadSlots(true, m_mesh.transparentSlots[sy], transparentMoved);
+    return true;
+}
+
+void Chunk::uploadSlots(bool transparent, const SectionSlots &section, bool moved) {
+    if (moved) {
+        uploadPass(transparent);
+        return;
+    }
+    const std::vector<Vertex> &vbo = transparent ? m_mesh.vboTransparent : m_mesh.vboOpaque;
+    mp_arena->write(transparent ? m_rangeTransparent : m_rangeOpaque, 4 * section.first,
+                    vbo.data() + 4 * section.first, 4 * section.capacity);
+}
+
+void Chunk::uploadPass(bool transparent) {
+    const std::vector<Vertex> &vbo = transparent ? m_mesh.vboTransparent : m_mesh.vboOpaque;
+    ArenaRange &range = transparent ? m_rangeTransparent : m_rangeOpaque;
+
+    // Kept while the mesh fits and does not leave most of it unused
+    if (vbo.size() > range.capacity() || 2 * vbo.size() < range.capacity()) {
+        mp_arena->release(range);
+        range = mp_arena->allocate(vbo.size(), glm::ivec2(minX, minZ));
+    }
+    mp_arena->write(range, 0, vbo.data(), vbo.size());
+    // Every quad is two triangles
+    (transparent ? m_countTransparent : m_countOpaque) = vbo.size() / 4 * 6;
+}
+
+void Chunk::transparentChanged() {
+    m_transparentVersion++;
+    m_transparentSorted = false;
+}
+
+void Chunk::sortTransparentQuads(std::vector<Vertex> &vbo,
+                                 const std::array<SectionSlots, 16> &sections, glm::vec3 eye) {
+    std::vector<std::pair<float, uint32_t>> order;
+    std::vector<Vertex> sorted;
+    for (const SectionSlots &s : sections) {
+        if (s.count < 2) continue;
+
+        order.clear();
+        for (uint32_t q = 0; q < s.count; q++) {
+            // The first and third vertices are opposite corners
+            const Vertex *v = &vbo[4 * (s.first + q)];
+            glm::vec3 toCenter = glm::vec3(v[0].pos() + v[2].pos()) * 0.5f - eye;
+            order.emplace_back(glm::dot(toCenter, toCenter), q);
+        }
+        std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+
+        sorted.clear();
+        for (const auto &entry : order) {
+            auto quad = vbo.begin() + 4 * (s.first + entry.second);
+            sorted.insert(sorted.end(), quad, quad + 4);
+        }
+        std::copy(sorted.begin(), sorted.end(), vbo.begin() + 4 * s.first);
+    }
+}
+
+uint64_t Chunk::transparentVersion() const {
+    return m_transparentVersion;
+}
+
+bool Chunk::isSortedFor(glm::ivec3 eyeBlock) const {
+    return m_transparentSorted && m_sortedEye == eyeBlock;
+}
+
+bool Chunk::setSortedTransparent(std::vector<Vertex> &&vbo, uint64_t version, glm::ivec3 eyeBlock) {
+    if (version != m_transparentVersion || !validVBOonCPU
+        || vbo.size() != m_mesh.vboTransparent.size()) {
+        return false;
+    }
+    m_mesh.vboTransparent = std::move(vbo);
+    m_transparentSorted = true;
+    m_sortedEye = eyeBlock;
+    // Same size, so it is written over its range
+    if (validVBOonGPU) uploadPass(true);
+    return true;
+}
+
+const ChunkMesh& Chunk::mesh() const {
+    return m_mesh;
+}
+
+bool Chunk::meshBounds(glm::vec3 &min, glm::vec3 &max) const {
+    if (!validVBOonGPU) return false;
+    int lowest = -1, highest = -1;
+    for (int sy = 0; sy < 16; sy++) {
+        if (m_mesh.opaqueSlots[sy].count > 0 || m_mesh.transparentSlots[sy].count > 0) {
+            if (lowest < 0) lowest = sy;
+            highest = sy;
+        }
+    }
+    if (lowest < 0) return false;
+
+    min = glm::vec3(minX, 16 * lowest, minZ);
+    max = glm::vec3(minX + 16, 16 * highest + 16, minZ + 16);
+    return true;
+}
+
+void Chunk::createVBOdata() {
+    // use cached VBO data if possible
+    if (validVBOonCPU) return;
+
+    buildMesh(ChunkView(this), s_meshingMode, m_mesh);
+    transparentChanged();
 
     // cache VBO data
     validVBOonCPU = true;
     validVBOonGPU = false;
 }
 
-void Chunk::sendVBOdata() {
+void Chunk::setVBOdata(ChunkMesh &&mesh) {
+    m_mesh = std::move(mesh);
+    transparentChanged();
+    validVBOonCPU = true;
+    validVBOonGPU = false;
+}
+
+void Chunk::sendVBOdata(TerrainArena &arena) {
     // use cached VBO data if possible
     if (validVBOonGPU) return;
 
-    m_countOpaque = idxOpaque.size();
-    generateIdxOpaque();
-    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bufIdxOpaque);
-    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxOpaque.size() * sizeof(GLuint), idxOpaque.data(), GL_STATIC_DRAW);
-    generateVboQpaque();
-    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufVboOpaque);
-    mp_context->glBufferData(GL_ARRAY_BUFFER, vboOpaque.size() * sizeof(Vertex), vboOpaque.data(), GL_STATIC_DRAW);
-
-    m_countTransparent = idxTransparent.size();
-    generateIdxTransparent();
-    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bufIdxTransparent);
-    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxTransparent.size() * sizeof(GLuint), idxTransparent.data(), GL_STATIC_DRAW);
-    generateVboTransparent();
-    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufVboTransparent);
-    mp_context->glBufferData(GL_ARRAY_BUFFER, vboTransparent.size() * sizeof(Vertex), vboTransparent.data(), GL_STATIC_DRAW);
+    mp_arena = &arena;
+    uploadPass(false);
+    uploadPass(true);
 
     // cache VBO data
     validVBOonGPU = true;
 }
 
+const ArenaRange& Chunk::opaqueRange() const {
+    return m_rangeOpaque;
+}
+
+const ArenaRange& Chunk::transparentRange() const {
+    return m_rangeTransparent;
+}
+
 void Chunk::destroyVBOdata() {
     InterleavedDrawable::destroyVBOdata();
+    if (mp_arena) {
+        mp_arena->release(m_rangeOpaque);
+        mp_arena->release(m_rangeTransparent);
+    }
     m_countOpaque = 0;
-    idxOpaque.clear();
-    vboOpaque.clear();
     m_countTransparent = 0;
-    idxTransparent.clear();
-    vboTransparent.clear();
+    m_mesh.clear();
+    transparentChanged();
     validVBOonCPU = false;
     validVBOonGPU = false;
 }
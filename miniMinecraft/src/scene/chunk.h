@@ -2,9 +2,15 @@
 #include "drawable.h"
 #include "smartpointerhelp.h"
 #include <array>
+#include <atomic>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include <cstddef>
+#include <cstdint>
 #include "biome.h"
+#include "blockstorage.h"
+#include "terrainarena.h"
 
 
 //using namespace std;
@@ -30,6 +36,12 @@ enum Direction : unsigned char
     XPOS, XNEG, YPOS, YNEG, ZPOS, ZNEG
 };
 
+// Directions come in opposite pairs, so flipping the
+// lowest bit turns a Direction around
+inline Direction oppositeDirection(Direction dir) {
+    return static_cast<Direction>(dir ^ 1);
+}
+
 // Lets us use any enum class as the key of a
 // std::unordered_map
 struct EnumHash {
@@ -39,12 +51,88 @@ struct EnumHash {
     }
 };
 
-struct alignas(sizeof(float)) Vertex {
-    glm::vec3 pos;
-    glm::vec3 nor;
-    glm::vec2 uv;
+// A Chunk vertex packed into a single 32-bit word.
+// Positions are local to the Chunk, and the normal and UVs are
+// reconstructed in lambert.vert.glsl from the face and the tile index.
+//   bits  0 -  4: x in [0, 16]
+//   bits  5 - 13: y in [0, 256]
+//   bits 14 - 18: z in [0, 16]
+//   bits 19 - 21: the Direction the face points in
+//   bits 22 - 29: the tile in the 16 x 16 texture atlas, column + 16 * row
+struct Vertex {
+    uint32_t data;
+
+    Vertex(glm::ivec3 pos, Direction dir, glm::ivec2 tile)
+        : data(uint32_t(pos.x) | uint32_t(pos.y) << 5 | uint32_t(pos.z) << 14 |
+               uint32_t(dir) << 19 | uint32_t(tile.x + 16 * tile.y) << 22) {}
+
+    glm::ivec3 pos() const {
+        return glm::ivec3(data & 0x1f, (data >> 5) & 0x1ff, (data >> 14) & 0x1f);
+    }
+    Direction dir() const {
+        return Direction((data >> 19) & 0x7);
+    }
+    glm::ivec2 tile() const {
+        return glm::ivec2((data >> 22) & 0xf, (data >> 26) & 0xf);
+    }
+};
+
+// The ways createVBOdata can turn visible block faces into quads.
+// PER_FACE emits one quad for every visible face, GREEDY merges
+// adjacent coplanar faces of the same BlockType into larger quads
+// and lets the texture repeat across them.
+enum MeshingMode : unsigned char
+{
+    PER_FACE, GREEDY
+};
+
+// Where the quads of one section lie in one pass of a ChunkMesh, counted
+// in quads of 4 vertices and 6 indices each. The quads the section has are
+// followed by spare slots holding degenerate quads, which draw nothing, so
+// an edit that adds a few faces rarely has to move the sections after it.
+struct SectionSlots {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+};
+
+// The CPU-side interleaved geometry of one Chunk,
+// split into the opaque and the transparent pass.
+// Sections are laid out from the bottom up, each in its own slots, so
+// one can be meshed again and written over in place. There are no
+// indices, since every quad is indexed the same way from its first
+// vertex, see TerrainArena.
+struct ChunkMesh {
+    std::vector<Vertex> vboOpaque;
+    std::vector<Vertex> vboTransparent;
+    std::array<SectionSlots, 16> opaqueSlots;
+    std::array<SectionSlots, 16> transparentSlots;
+
+    void clear();
+    // Not counting spare slots
+    size_t vertexCount() const;
+    // The bytes the mesh takes up on the GPU, spare slots included
+    size_t byteSize() const;
+};
+
+struct SectionFaces;
+class ChunkView;
+
+// How far generation has brought a Chunk's blocks
+enum GenerationStage : unsigned char
+{
+    // Nothing generated yet
+    NOT_GENERATED,
+    // Terrain, water and caves, which only depend on the Chunk itself
+    BASE_TERRAIN,
+    // Trees and other plants too, which may reach into neighbors
+    DECORATED
+};
 
-    Vertex(glm::vec3 pos, glm::vec3 nor, glm::vec2 uv) : pos(pos), nor(nor), uv(uv) {}
+// What one 16 x 16 x 16 section of a Chunk holds
+enum SectionKind : unsigned char
+{
+    ALL_AIR, UNIFORM, MIXED
 };
 
 // One Chunk is a 16 x 256 x 16 section of the world,
@@ -57,27 +145,92 @@ struct alignas(sizeof(float)) Vertex {
 // TODO have Chunk inherit from Drawable
 class Chunk : public InterleavedDrawable {
 private:
-    // All of the blocks contained within this Chunk
-    std::array<BlockType, 65536> m_blocks;
+    // All of the blocks contained within this Chunk, split vertically
+    // into sixteen 16 x 16 x 16 sections. Sections that are entirely
+    // EMPTY are not allocated.
+    std::array<uPtr<BlockStorage>, 16> m_sections;
+
+    // This Chunk's four neighbors to the north, south, east, and west,
+    // indexed by Direction. The YPOS and YNEG entries are always null.
+    std::array<Chunk*, 6> m_neighbors;
+
+    // Advanced by the generation passes once they have filled in their
+    // blocks, read by the main thread to tell when workers may look at them
+    std::atomic<GenerationStage> m_stage {NOT_GENERATED};
 
-    // This Chunk's four neighbors to the north, south, east, and west
-    // The third input to this map just lets us use a Direction as
-    // a key for this map.
-    // These allow us to properly determine
-    std::unordered_map<Direction, Chunk*, EnumHash> m_neighbors;
+    // What the base terrain pass found about one column, for decorate
+    struct ColumnSurface {
+        short height;
+        BiomeType biome;
+    };
+    // Indexed x + 16 * z. Only kept between the two passes.
+    uPtr<std::array<ColumnSurface, 16 * 16>> m_surface;
+
+    // A block a neighbor's plant placed in this Chunk
+    struct DecorationBlock {
+        unsigned char x, z;
+        unsigned short y;
+        BlockType type;
+    };
+    // Every block neighbors' plants placed in this Chunk. Those placed
+    // before it was decorated go in after its own plants, so those do not
+    // depend on which Chunk happened to be decorated first. Kept when the
+    // blocks are released, since the neighbors do not plant them again.
+    std::vector<DecorationBlock> m_incomingDecorations;
+
+    // Advanced by every change to the blocks or the decorations log, so a
+    // record of the Chunk is up to date while it equals m_savedGeneration.
+    // Only written by whichever thread may write the blocks.
+    uint64_t m_generation = 0;
+    // The generation the newest record in the RegionStore holds
+    uint64_t m_savedGeneration = 0;
 
     // render optimization ----------------------------
     bool validVBOonCPU = false;
     bool validVBOonGPU = false;
-    // opaque vbo cache
-    std::vector<GLuint> idxOpaque;
-    std::vector<Vertex> vboOpaque;
-    // transparent vbo cache
-    std::vector<GLuint> idxTransparent;
-    std::vector<Vertex> vboTransparent;
+    // opaque and transparent vbo cache
+    ChunkMesh m_mesh;
+    // Where the uploaded mesh lies, in the arena it was sent to
+    TerrainArena *mp_arena = nullptr;
+    ArenaRange m_rangeOpaque;
+    ArenaRange m_rangeTransparent;
+    // Bumped whenever the transparent quads change, so that sorting
+    // a copy taken before can be told apart from an up to date one
+    uint64_t m_transparentVersion = 0;
+    // Whether the transparent quads are sorted for a camera in m_sortedEye
+    bool m_transparentSorted = false;
+    glm::ivec3 m_sortedEye;
     // ------------------------------------------------
 
+    // The mesher used by createVBOdata for every Chunk
+    static MeshingMode s_meshingMode;
+    // How generateChunk samples the cave noise
+    static CaveSampling s_caveSampling;
+
     bool isCaveBlockInWater(int x, int y, int z);
+    void decorateColumn(int x, int z);
+    // Sets a block of a plant rooted in this Chunk. x and z may lie up to
+    // 16 blocks past its edges, in which case the block goes to that
+    // neighbor, diagonal ones included, or is dropped if it does not exist.
+    void placeDecoration(int x, int y, int z, BlockType t);
+    // Places a block of a neighbor's plant, see placeDecoration
+    void receiveDecoration(int x, int y, int z, BlockType t);
+    // Frees the sections that no longer hold any non-EMPTY block
+    void releaseEmptySections();
+    // Can meshing skip section sy because none of its faces are visible?
+    bool canSkipSection(const ChunkView &view, int sy) const;
+    // Finds every visible block face of section sy with row bitmasks
+    void computeVisibleFaces(const ChunkView &view, int sy, SectionFaces &faces) const;
+    // Both append the quads of section sy's visible faces to the end of the mesh
+    void buildSectionPerFace(const SectionFaces &faces, int sy, ChunkMesh &mesh) const;
+    void buildSectionGreedy(const SectionFaces &faces, int sy, ChunkMesh &mesh) const;
+    // Writes over the part of the uploaded pass that changed, or all
+    // of it if its sections were moved
+    void uploadSlots(bool transparent, const SectionSlots &section, bool moved);
+    // Writes the whole pass to the arena, moving it to a range of
+    // its size if it has outgrown its range or shrunk well below it
+    void uploadPass(bool transparent);
+    void transparentChanged();
 
 public:
     int minX, minZ;
@@ -89,19 +242,121 @@ public:
     BlockType getBlockAt(int x, int y, int z) const;
     void setBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t);
     void linkNeighbor(uPtr<Chunk>& neighbor, Direction dir);
+    // The neighboring Chunk in the given Direction, or nullptr
+    Chunk* neighbor(Direction dir) const;
+    GenerationStage generationStage() const;
+    // Whether the base terrain has been generated
+    bool hasBlockData() const;
 
     // Milestone 1
+    // Runs both generation passes, for a Chunk generated on its own.
+    // Plants reaching into neighbors that do not exist are cut off.
     void generateChunk(int x_off, int z_off);
-    void generateBlock(int x, int z, int x_off, int z_off);
+    void generateChunk(int x_off, int z_off, CaveSampling caveSampling);
+    // The first generation pass, which only writes this Chunk's blocks
+    void generateBaseTerrain(int x_off, int z_off, CaveSampling caveSampling);
+    void generateBlock(int x, int z, int x_off, int z_off, const CaveNoise &caves);
+    // The second generation pass, which plants trees and other plants that
+    // may write up to two blocks into the neighbors. All eight neighbors
+    // that exist must have their base terrain, and no other thread may
+    // touch their blocks or this Chunk's until it returns.
+    void decorate();
+    static void setCaveSampling(CaveSampling sampling);
+    static CaveSampling caveSampling();
     virtual void createVBOdata() override;
+    // Replaces the cached VBO data with a mesh built elsewhere,
+    // which the next sendVBOdata uploads
+    void setVBOdata(ChunkMesh &&mesh);
+    // Fills the given mesh with the faces of the Chunk the view looks at,
+    // which must be this one, using the given mesher and without
+    // touching the cached VBO data
+    void buildMesh(const ChunkView &view, MeshingMode mode, ChunkMesh &mesh) const;
+    static void setMeshingMode(MeshingMode mode);
+    static MeshingMode meshingMode();
+    // Meshes section sy again after one of its blocks, or of the blocks
+    // next to it, changed, and writes it over its slots in the cached mesh
+    // and the uploaded buffers. Costs a section's worth of meshing instead
+    // of the whole Chunk's. Returns false, changing nothing, if there is no
+    // cached mesh to patch. The rest of the cached mesh must be up to date,
+    // and the same rules apply as for creating a ChunkView.
+    bool remeshSection(int sy);
+    const ChunkMesh& mesh() const;
+    // The world-space box around the uploaded mesh, from the bottom of its
+    // lowest section with any quads to the top of its highest. Returns
+    // false if nothing is uploaded or there are no quads.
+    bool meshBounds(glm::vec3 &min, glm::vec3 &max) const;
+    // Orders the quads of every section of a transparent pass from the
+    // farthest to the nearest to the eye, which is relative to the Chunk's
+    // corner, so blending them in order composites them correctly.
+    // Quads keep to their section and the spare slots stay at its end.
+    static void sortTransparentQuads(std::vector<Vertex> &vbo,
+                                     const std::array<SectionSlots, 16> &sections, glm::vec3 eye);
+    uint64_t transparentVersion() const;
+    // Whether the transparent quads are sorted for a camera in the given block
+    bool isSortedFor(glm::ivec3 eyeBlock) const;
+    // Replaces the transparent pass with a sorted copy of the given version
+    // of it, and uploads it if the mesh is uploaded. Returns false, changing
+    // nothing, if the quads have changed since.
+    bool setSortedTransparent(std::vector<Vertex> &&vbo, uint64_t version, glm::ivec3 eyeBlock);
 
     // Milestone 2
-    void sendVBOdata();
+    // Sends the cached VBO data to the arena, which the Chunk
+    // keeps its mesh in from then on
+    void sendVBOdata(TerrainArena &arena);
     void destroyVBOdata();
+    const ArenaRange& opaqueRange() const;
+    const ArenaRange& transparentRange() const;
 
     // Milestone 3
     void plantATree(int x, int h, int z, int type);
 
+    // The bytes used to store this Chunk's blocks, not counting
+    // those borrowed from a mapped region file
+    size_t blockMemoryUsage() const;
+    size_t borrowedBlockBytes() const;
+    // The bytes its blocks and the CPU copy of its mesh use
+    size_t residentMemoryUsage() const;
+    // Frees the blocks, the mesh and the VBOs, taking the Chunk back to
+    // NOT_GENERATED so it can be generated or loaded again. No job may be reading
+    // or writing it.
+    void releaseBlockData();
+    // What section sy (y from 16 * sy to 16 * sy + 15) holds. If it is
+    // ALL_AIR or UNIFORM and out_type is given, it is set to that type.
+    SectionKind sectionKind(int sy, BlockType *out_type = nullptr) const;
+
+    // A copy of what a later session needs to restore a Chunk: the blocks
+    // of a decorated Chunk, and the blocks neighbors' plants placed in it.
+    // Taken on the main thread so the record can be encoded and written on
+    // a worker while the Chunk goes on changing. Sections borrowing their
+    // blocks are shared with the Chunk rather than copied.
+    struct Snapshot {
+        int minX, minZ;
+        uint64_t generation;
+        GenerationStage stage;
+        std::vector<DecorationBlock> decorations;
+        std::array<uPtr<BlockStorage>, 16> sections;
+
+        // Encodes the record. Returns false, leaving out
+        // empty, if there is nothing worth saving.
+        bool serialize(std::vector<unsigned char> &out) const;
+    };
+    // No job may be writing the Chunk
+    std::shared_ptr<const Snapshot> snapshot() const;
+    // Restores a record Snapshot::serialize wrote. Blocks are only restored from the
+    // record of a decorated Chunk, which takes this one to DECORATED; blocks
+    // neighbors placed since the record was written are applied on top.
+    // If owner is given, it keeps data alive and unchanged, and the sections
+    // borrow their blocks from it until they are first changed.
+    // Returns false, leaving the Chunk untouched, if the record is malformed.
+    // No other thread may touch the Chunk, which must be NOT_GENERATED.
+    bool deserialize(const unsigned char *data, size_t size,
+                     std::shared_ptr<const void> owner = nullptr);
+    // Whether the blocks or decorations log changed since the
+    // generation last handed to markSaved
+    bool isDirty() const;
+    uint64_t generation() const;
+    void markSaved(uint64_t generation);
+
 };
 
 struct ChunkVBOData
@@ -0,0 +1,76 @@
+#include "chunkscheduler.h"
+#include "terrain.h"
+#include <algorithm>
+
+ChunkScheduler::ChunkScheduler()
+    : m_tasks(), m_queuedZones(), m_queuedChunks()
+{}
+
+void ChunkScheduler::scheduleZone(int64_t zone) {
+    if (!m_queuedZones.insert(zone).second) return;
+    m_tasks.push_back(Task{GENERATE_ZONE, zone, nullptr, 0.f});
+}
+
+void ChunkScheduler::scheduleMesh(Chunk *c) {
+    if (!m_queuedChunks.insert(c).second) return;
+    m_tasks.push_back(Task{MESH_CHUNK, zoneKeyOf(c->minX, c->minZ), c, 0.f});
+}
+
+glm::vec2 ChunkScheduler::centerOf(const Task &t) {
+    if (t.type == MESH_CHUNK) {
+        return glm::vec2(t.chunk->minX + 8, t.chunk->minZ + 8);
+    }
+    glm::ivec2 corner = toCoords(t.zone);
+    return glm::vec2(corner.x + 32, corner.y + 32);
+}
+
+void ChunkScheduler::cancelOutside(const QSet<int64_t> &zones) {
+    auto cancelled = [&](const Task &t) {
+        if (zones.contains(t.zone)) return false;
+        if (t.type == MESH_CHUNK) {
+            m_queuedChunks.erase(t.chunk);
+        } else {
+            m_queuedZones.erase(t.zone);
+        }
+        return true;
+    };
+    m_tasks.erase(std::remove_if(m_tasks.begin(), m_tasks.end(), cancelled), m_tasks.end());
+}
+
+float ChunkScheduler::priority(glm::vec2 p, glm::vec3 playerPos, glm::vec3 viewDir) {
+    glm::vec2 toP = p - glm::vec2(playerPos.x, playerPos.z);
+    float dist = glm::length(toP);
+    glm::vec2 view(viewDir.x, viewDir.z);
+    float viewLen = glm::length(view);
+    if (dist < 1e-3f || viewLen < 1e-3f) return dist;
+
+    // 1 straight ahead, -1 straight behind
+    float facing = glm::dot(toP / dist, view / viewLen);
+    return dist * (1.5f - 0.5f * facing);
+}
+
+std::vector<ChunkScheduler::Task> ChunkScheduler::takeNext(glm::vec3 playerPos, glm::vec3 viewDir, size_t count) {
+    // Priorities are recomputed on every call, since the player
+    // may have moved or turned since the tasks were queued
+    for (Task &t : m_tasks) {
+        t.priority = priority(centerOf(t), playerPos, viewDir);
+    }
+    count = std::min(count, m_tasks.size());
+    std::partial_sort(m_tasks.begin(), m_tasks.begin() + count, m_tasks.end(),
+                      [](const Task &a, const Task &b) { return a.priority < b.priority; });
+
+    std::vector<Task> next(m_tasks.begin(), m_tasks.begin() + count);
+    m_tasks.erase(m_tasks.begin(), m_tasks.begin() + count);
+    for (const Task &t : next) {
+        if (t.type == MESH_CHUNK) {
+            m_queuedChunks.erase(t.chunk);
+        } else {
+            m_queuedZones.erase(t.zone);
+        }
+    }
+    return next;
+}
+
+size_t ChunkScheduler::pendingCount() const {
+    return m_tasks.size();
+}
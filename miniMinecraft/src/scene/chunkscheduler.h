@@ -0,0 +1,52 @@
+#pragma once
+#include "chunk.h"
+#include <QSet>
+#include <unordered_set>
+#include <vector>
+
+// Decides which generation and meshing work the JobSystem runs next.
+// Work waits here rather than in the JobSystem's own queues, so it can be
+// reordered every frame as the player moves and turns, and dropped once
+// its zone leaves the loaded radius.
+class ChunkScheduler {
+public:
+    enum TaskType : unsigned char
+    {
+        GENERATE_ZONE, MESH_CHUNK
+    };
+
+    struct Task {
+        TaskType type;
+        // The terrain generation zone the task works in
+        int64_t zone;
+        // The Chunk, for MESH_CHUNK
+        Chunk *chunk;
+        // Lower runs sooner, see priority()
+        float priority;
+    };
+
+private:
+    std::vector<Task> m_tasks;
+    // What m_tasks holds, so nothing is queued twice
+    std::unordered_set<int64_t> m_queuedZones;
+    std::unordered_set<Chunk*> m_queuedChunks;
+
+    // The world-space xz center of the area a task works on
+    static glm::vec2 centerOf(const Task &t);
+
+public:
+    ChunkScheduler();
+
+    void scheduleZone(int64_t zone);
+    void scheduleMesh(Chunk *c);
+    // Drops every task whose zone is not one of the given ones
+    void cancelOutside(const QSet<int64_t> &zones);
+    // Removes and returns up to count tasks, those closest to
+    // the player and most in front of the camera first
+    std::vector<Task> takeNext(glm::vec3 playerPos, glm::vec3 viewDir, size_t count);
+    size_t pendingCount() const;
+
+    // The distance from the player to p on the xz plane, counted
+    // as up to twice as far when p is behind the camera
+    static float priority(glm::vec2 p, glm::vec3 playerPos, glm::vec3 viewDir);
+};
@@ -0,0 +1,71 @@
+#include "chunkview.h"
+#include <algorithm>
+
+ChunkView::ChunkView(const Chunk *c, int firstSection, int lastSection)
+    : mp_chunk(c), m_borders()
+{
+    for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+        const Chunk *n = c->neighbor(dir);
+        if (!n) continue;
+
+        // A value-initialized Border is all EMPTY, which is
+        // what a neighbor that has not been generated holds
+        m_borders[dir] = mkU<Border>();
+        if (!n->hasBlockData()) continue;
+
+        Border &b = *m_borders[dir];
+        // The neighbor's face that touches this Chunk
+        unsigned int face = (dir == XPOS || dir == ZPOS) ? 0 : 15;
+        for (int sy = firstSection; sy <= lastSection; sy++) {
+            b.kinds[sy] = n->sectionKind(sy, &b.types[sy]);
+            auto first = b.blocks.begin() + 256 * sy;
+            if (b.kinds[sy] != MIXED) {
+                std::fill_n(first, 256, b.types[sy]);
+                continue;
+            }
+            for (unsigned int y = 16 * sy; y < 16u * sy + 16; y++) {
+                for (unsigned int i = 0; i < 16; i++) {
+                    b.blocks[y * 16 + i] = (dir == XPOS || dir == XNEG)
+                                           ? n->getBlockAt(face, y, i)
+                                           : n->getBlockAt(i, y, face);
+                }
+            }
+        }
+    }
+}
+
+const Chunk* ChunkView::chunk() const {
+    return mp_chunk;
+}
+
+BlockType ChunkView::getBorderBlockAt(Direction dir, int y, int i) const {
+    const uPtr<Border> &b = m_borders[dir];
+    return b ? b->blocks[y * 16 + i] : UNKNOWN;
+}
+
+BlockType ChunkView::getBlockAt(int x, int y, int z) const {
+    if (y < 0) {
+        return UNKNOWN;
+    } else if (y >= 256) {
+        return EMPTY;
+    } else if (x < 0) {
+        return getBorderBlockAt(XNEG, y, z);
+    } else if (x >= 16) {
+        return getBorderBlockAt(XPOS, y, z);
+    } else if (z < 0) {
+        return getBorderBlockAt(ZNEG, y, x);
+    } else if (z >= 16) {
+        return getBorderBlockAt(ZPOS, y, x);
+    }
+    return mp_chunk->getBlockAt(static_cast<unsigned int>(x), static_cast<unsigned int>(y), static_cast<unsigned int>(z));
+}
+
+SectionKind ChunkView::neighborSectionKind(Direction dir, int sy, BlockType *out_type) const {
+    const uPtr<Border> &b = m_borders[dir];
+    if (!b) {
+        if (out_type) *out_type = UNKNOWN;
+        return UNIFORM;
+    }
+    if (b->kinds[sy] != MIXED && out_type) *out_type = b->types[sy];
+    return b->kinds[sy];
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "chunk.h"
+
+// A read-only view of one Chunk for the worker threads, together with
+// copies of the blocks its four horizontal neighbors hold along the faces
+// they share with it. The copies are made on the main thread when the view
+// is created, so meshing can read across Chunk borders without chasing
+// neighbor pointers and without racing a neighbor that another worker
+// is still generating.
+// Neighbors that do not exist read as UNKNOWN, like Chunk::getBlockAt,
+// and neighbors that have not been generated yet read as EMPTY.
+class ChunkView {
+private:
+    // One neighbor's blocks along the shared face
+    struct Border {
+        // What each of the neighbor's sections holds, see Chunk::sectionKind
+        std::array<SectionKind, 16> kinds;
+        std::array<BlockType, 16> types;
+        // Indexed y * 16 + i, where i is the x or z coordinate along the face
+        std::array<BlockType, 256 * 16> blocks;
+    };
+
+    const Chunk *mp_chunk;
+    // Indexed by Direction. Null for missing neighbors, YPOS and YNEG.
+    std::array<uPtr<Border>, 6> m_borders;
+
+    BlockType getBorderBlockAt(Direction dir, int y, int i) const;
+
+public:
+    // Must be called on the main thread. Only the neighbors' blocks
+    // next to sections firstSection to lastSection are copied, and only
+    // those sections may be looked at.
+    explicit ChunkView(const Chunk *c, int firstSection = 0, int lastSection = 15);
+
+    const Chunk* chunk() const;
+
+    // Takes chunk-local coordinates, which may lie one block
+    // past the Chunk's edges on the x and z axes
+    BlockType getBlockAt(int x, int y, int z) const;
+    // Same as Chunk::sectionKind on the neighbor in the given
+    // horizontal Direction. Missing neighbors are UNIFORM UNKNOWN.
+    SectionKind neighborSectionKind(Direction dir, int sy, BlockType *out_type = nullptr) const;
+};
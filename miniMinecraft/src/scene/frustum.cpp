@@ -0,0 +1,25 @@
+#include "frustum.h"
+
+// Gribb and Hartmann's method: in clip space the frustum is -w <= x, y, z <= w,
+// and each of those inequalities is a plane made of two rows of the matrix.
+// glm matrices are indexed [column][row].
+Frustum::Frustum(const glm::mat4 &viewProj) {
+    auto row = [&viewProj](int i) {
+        return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+    };
+    for (int axis = 0; axis < 3; axis++) {
+        m_planes[2 * axis] = row(3) + row(axis);
+        m_planes[2 * axis + 1] = row(3) - row(axis);
+    }
+}
+
+bool Frustum::intersectsBox(glm::vec3 min, glm::vec3 max) const {
+    for (const glm::vec4 &plane : m_planes) {
+        // The corner furthest along the plane's normal
+        glm::vec3 p(plane.x >= 0 ? max.x : min.x,
+                    plane.y >= 0 ? max.y : min.y,
+                    plane.z >= 0 ? max.z : min.z);
+        if (glm::dot(glm::vec3(plane), p) + plane.w < 0) return false;
+    }
+    return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "glm_includes.h"
+#include <array>
+
+// The six planes bounding what a camera sees, taken from its
+// view-projection matrix. Used to skip drawing what is off screen.
+class Frustum {
+private:
+    // Each is (normal, d), with the normal pointing into the
+    // frustum, so a point p is inside if dot(normal, p) + d >= 0
+    std::array<glm::vec4, 6> m_planes;
+
+public:
+    explicit Frustum(const glm::mat4 &viewProj);
+
+    // Conservative: a box near a corner of the frustum can be
+    // reported as intersecting it while lying just outside
+    bool intersectsBox(glm::vec3 min, glm::vec3 max) const;
+};
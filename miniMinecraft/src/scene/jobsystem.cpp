@@ -0,0 +1,160 @@
+#include "jobsystem.h"
+#include <algorithm>
+#include <chrono>
+
+// How many completions can wait for the main thread. A frame can start
+// many more jobs than there are workers, a zone's base terrain and the
+// ring around it alone being 36, and a SortWorker reports a completion
+// for every Chunk it sorted, so this is only a size that is rarely
+// reached. When it is, workers spin in complete until the main thread's
+// next takeCompleted, or waitForIdle, drains the queue.
+static const size_t COMPLETION_CAPACITY = 1024;
+
+// The JobSystem and queue of the worker running on this thread, if any
+static thread_local JobSystem *t_jobSystem = nullptr;
+static thread_local int t_workerIndex = -1;
+
+JobSystem::JobSystem(int workerCount)
+    : m_queues(), m_threads(), m_nextQueue(0), m_queued(0), m_unfinished(0),
+      m_sleepLock(), m_wake(), m_idle(), m_stop(false),
+      m_completed(COMPLETION_CAPACITY), m_drained()
+{
+    for (std::atomic<int> &count : m_unfinishedOfType) {
+        count = 0;
+    }
+    workerCount = std::max(workerCount, 1);
+    for (int i = 0; i < workerCount; i++) {
+        m_queues.push_back(mkU<WorkerQueue>());
+    }
+    for (int i = 0; i < workerCount; i++) {
+        m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &t : m_threads) {
+        t.join();
+    }
+}
+
+int JobSystem::workerCount() const {
+    return static_cast<int>(m_threads.size());
+}
+
+int JobSystem::unfinishedCount() const {
+    return m_unfinished.load();
+}
+
+int JobSystem::unfinishedCount(JobType type) const {
+    return m_unfinishedOfType[type].load();
+}
+
+void JobSystem::submit(JobType type, uPtr<QRunnable> task) {
+    unsigned int index = (t_jobSystem == this)
+                         ? static_cast<unsigned int>(t_workerIndex)
+                         : m_nextQueue++ % m_queues.size();
+    m_unfinished++;
+    m_unfinishedOfType[type]++;
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->lock);
+        m_queues[index]->jobs.push_back(Job{type, std::move(task)});
+    }
+    m_queued++;
+
+    // Taking the lock keeps a worker from missing the wake-up
+    // between checking m_queued and going to sleep
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+    }
+    m_wake.notify_one();
+}
+
+bool JobSystem::takeJob(int index, Job &out) {
+    {
+        WorkerQueue &own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.jobs.empty()) {
+            out = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            m_queued--;
+            return true;
+        }
+    }
+
+    int count = static_cast<int>(m_queues.size());
+    for (int i = 1; i < count; i++) {
+        WorkerQueue &victim = *m_queues[(index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.jobs.empty()) {
+            out = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            m_queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::workerLoop(int index) {
+    t_jobSystem = this;
+    t_workerIndex = index;
+
+    while (!m_stop) {
+        Job job;
+        if (takeJob(index, job)) {
+            job.task->run();
+            job.task.reset();
+            m_unfinishedOfType[job.type]--;
+            if (--m_unfinished == 0) {
+                std::lock_guard<std::mutex> lock(m_sleepLock);
+                m_idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepLock);
+        m_wake.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+    }
+}
+
+void JobSystem::complete(JobType type, Chunk *c, ChunkMesh mesh) {
+    JobCompletion done{type, c, std::move(mesh)};
+    while (!m_completed.tryPush(std::move(done))) {
+        // Full until the main thread's next frame, or the job system is
+        // being destroyed and nobody will drain it
+        if (m_stop) return;
+        std::this_thread::yield();
+    }
+}
+
+std::vector<JobCompletion> JobSystem::takeCompleted() {
+    std::vector<JobCompletion> result = std::move(m_drained);
+    m_drained.clear();
+    JobCompletion done;
+    while (m_completed.tryPop(done)) {
+        result.push_back(std::move(done));
+    }
+    return result;
+}
+
+void JobSystem::waitForIdle() {
+    std::unique_lock<std::mutex> lock(m_sleepLock);
+    while (!m_idle.wait_for(lock, std::chrono::milliseconds(1),
+                            [this] { return m_unfinished.load() == 0; })) {
+        // Jobs wait for room in the completion queue, so keep making it
+        JobCompletion done;
+        while (m_completed.tryPop(done)) {
+            m_drained.push_back(std::move(done));
+        }
+    }
+}
+
+int JobSystem::defaultWorkerCount() {
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(cores - 1, 1);
+}
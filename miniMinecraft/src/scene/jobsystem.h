@@ -0,0 +1,101 @@
+#pragma once
+#include "chunk.h"
+#include "smartpointerhelp.h"
+#include "mpscqueue.h"
+#include <QRunnable>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The kinds of work a JobSystem runs. GENERATE_JOB and DECORATE_JOB are
+// the two generation passes, see GenerationStage. Nothing submits
+// LIGHT_JOB yet; it is there for lighting Chunks. SORT_JOB orders a
+// copy of a Chunk's transparent quads for the camera.
+enum JobType : unsigned char
+{
+    GENERATE_JOB, DECORATE_JOB, MESH_JOB, LIGHT_JOB, SAVE_JOB, SORT_JOB
+};
+const int JOB_TYPE_COUNT = SORT_JOB + 1;
+
+// A piece of work a job reports back to the main thread
+struct JobCompletion
+{
+    JobType type;
+    // Null for SAVE_JOB, which works on many Chunks
+    Chunk *chunk;
+    // The mesh a MESH_JOB built, or the transparent pass a SORT_JOB
+    // sorted, moved rather than copied into and out of the completion
+    // queue. Empty for other jobs.
+    ChunkMesh mesh;
+};
+
+// Runs background work on its own worker threads. Every worker has its own
+// queue: it runs the newest job in it first, and once it is empty takes the
+// oldest job of another worker's queue, so work submitted in bursts spreads
+// across the threads without all of them contending for one queue.
+// Jobs hand their results back through a bounded lock-free queue that the
+// main thread drains once per frame with takeCompleted. Jobs wait for room
+// when it is full.
+class JobSystem {
+private:
+    struct Job {
+        JobType type;
+        uPtr<QRunnable> task;
+    };
+
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<uPtr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    // The queue the next job submitted from outside the workers goes to
+    std::atomic<unsigned int> m_nextQueue;
+    // Jobs waiting in the queues, and jobs waiting or running,
+    // in all and of each type
+    std::atomic<int> m_queued, m_unfinished;
+    std::array<std::atomic<int>, JOB_TYPE_COUNT> m_unfinishedOfType;
+
+    // Idle workers and waitForIdle sleep on these
+    std::mutex m_sleepLock;
+    std::condition_variable m_wake, m_idle;
+    std::atomic<bool> m_stop;
+
+    // Pushed by the workers and popped by the main thread
+    MPSCQueue<JobCompletion> m_completed;
+    // Completions waitForIdle popped to make room, for the next takeCompleted
+    std::vector<JobCompletion> m_drained;
+
+    void workerLoop(int index);
+    // Takes the newest job of the worker's own queue, or else the oldest of another's
+    bool takeJob(int index, Job &out);
+
+public:
+    explicit JobSystem(int workerCount);
+    // Waits for the running jobs and drops the ones that have not started
+    ~JobSystem();
+
+    int workerCount() const;
+    // The jobs submitted that have not finished
+    int unfinishedCount() const;
+    int unfinishedCount(JobType type) const;
+
+    // Can be called from any thread. A job submitted by a running
+    // job goes to the queue of the worker running it.
+    void submit(JobType type, uPtr<QRunnable> task);
+    // Called by running jobs to hand finished work to the main thread
+    void complete(JobType type, Chunk *c, ChunkMesh mesh = ChunkMesh());
+    // Everything completed since the last call, oldest first.
+    // Must only be called from the thread that submits the work.
+    std::vector<JobCompletion> takeCompleted();
+    // Blocks until every submitted job has finished. Same thread as takeCompleted.
+    void waitForIdle();
+
+    // One worker per core, leaving one core to the main thread
+    static int defaultWorkerCount();
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// A fixed-capacity queue that any number of threads push to and one thread
+// pops from, without locks. Every slot carries a sequence number saying
+// whose turn it is: producers claim a slot by advancing the shared write
+// position with a compare-and-swap, then publish the value by bumping the
+// slot's sequence, which the consumer waits to see before moving it out.
+// Capacity must be a power of two.
+template <typename T>
+class MPSCQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+    // Kept on separate cache lines, since producers hammer the first
+    // and only the consumer touches the second
+    alignas(64) std::atomic<size_t> m_writePos;
+    alignas(64) size_t m_readPos;
+
+public:
+    explicit MPSCQueue(size_t capacity)
+        : m_mask(capacity - 1), m_slots(new Slot[capacity]), m_writePos(0), m_readPos(0)
+    {
+        for (size_t i = 0; i < capacity; i++) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    size_t capacity() const {
+        return m_mask + 1;
+    }
+
+    // Can be called from any thread. Returns false, leaving value
+    // untouched, if the queue is full.
+    bool tryPush(T &&value) {
+        size_t pos = m_writePos.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true) {
+            slot = &m_slots[pos & m_mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t turn = static_cast<std::ptrdiff_t>(sequence - pos);
+            if (turn == 0) {
+                if (m_writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (turn < 0) {
+                // The slot still holds a value pushed one lap ago
+                return false;
+            } else {
+                pos = m_writePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Must only be called from the consuming thread. Returns false if
+    // nothing has been published in the next slot yet.
+    bool tryPop(T &out) {
+        Slot &slot = m_slots[m_readPos & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != m_readPos + 1) {
+            return false;
+        }
+        out = std::move(slot.value);
+        slot.value = T();
+        slot.sequence.store(m_readPos + m_mask + 1, std::memory_order_release);
+        m_readPos++;
+        return true;
+    }
+};
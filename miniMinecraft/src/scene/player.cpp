@@ -349,59 +349,34 @@ BlockType Player::addBlock(Terrain* terrian) {
         BlockType blockType = terrian->getBlockAt(outBlockHit.x-1 , outBlockHit.y, outBlockHit.z);
         if (blockType == EMPTY)
         {
-
-            terrian->setBlockAt(outBlockHit.x-1 , outBlockHit.y, outBlockHit.z, selectedBlockType);
-            terrian->getChunkAt(outBlockHit.x-1, outBlockHit.z).get()->destroyVBOdata();
-            terrian->getChunkAt(outBlockHit.x-1, outBlockHit.z).get()->createVBOdata();
-            terrian->getChunkAt(outBlockHit.x-1, outBlockHit.z).get()->sendVBOdata();
-            return selectedBlockType;
+            return terrian->editBlockAt(outBlockHit.x-1 , outBlockHit.y, outBlockHit.z, selectedBlockType) ? selectedBlockType : EMPTY;
         }
         blockType = terrian->getBlockAt(outBlockHit.x+1 , outBlockHit.y, outBlockHit.z);
         if (blockType == EMPTY)
         {
-            terrian->setBlockAt(outBlockHit.x+1 , outBlockHit.y, outBlockHit.z, selectedBlockType);
-            terrian->getChunkAt(outBlockHit.x+1, outBlockHit.z).get()->destroyVBOdata();
-            terrian->getChunkAt(outBlockHit.x+1, outBlockHit.z).get()->createVBOdata();
-            terrian->getChunkAt(outBlockHit.x+1, outBlockHit.z).get()->sendVBOdata();
-            return selectedBlockType;
+            return terrian->editBlockAt(outBlockHit.x+1 , outBlockHit.y, outBlockHit.z, selectedBlockType) ? selectedBlockType : EMPTY;
         }
         // check up
         blockType = terrian->getBlockAt(outBlockHit.x, outBlockHit.y-1, outBlockHit.z);
         if (blockType == EMPTY)
         {
-            terrian->setBlockAt(outBlockHit.x, outBlockHit.y-1, outBlockHit.z, selectedBlockType);
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->destroyVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->createVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->sendVBOdata();
-            return selectedBlockType;
+            return terrian->editBlockAt(outBlockHit.x, outBlockHit.y-1, outBlockHit.z, selectedBlockType) ? selectedBlockType : EMPTY;
         }
         blockType = terrian->getBlockAt(outBlockHit.x, outBlockHit.y+1, outBlockHit.z);
         if (blockType == EMPTY)
         {
-            terrian->setBlockAt(outBlockHit.x, outBlockHit.y+1, outBlockHit.z, selectedBlockType);
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->destroyVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->createVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->sendVBOdata();
-            return selectedBlockType;
+            return terrian->editBlockAt(outBlockHit.x, outBlockHit.y+1, outBlockHit.z, selectedBlockType) ? selectedBlockType : EMPTY;
         }
         // check right
         blockType = terrian->getBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z-1);
         if (blockType == EMPTY)
         {
-            terrian->setBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z-1, selectedBlockType);
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z-1).get()->destroyVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z-1).get()->createVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z-1).get()->sendVBOdata();
-            return selectedBlockType;
+            return terrian->editBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z-1, selectedBlockType) ? selectedBlockType : EMPTY;
         }
         blockType = terrian->getBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z+1);
         if (blockType == EMPTY)
         {
-            terrian->setBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z+1, selectedBlockType);
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z+1).get()->destroyVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z+1).get()->createVBOdata();
-            terrian->getChunkAt(outBlockHit.x, outBlockHit.z+1).get()->sendVBOdata();
-            return selectedBlockType;
+            return terrian->editBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z+1, selectedBlockType) ? selectedBlockType : EMPTY;
         }
     }
     return EMPTY;
@@ -418,10 +393,9 @@ BlockType Player::removeBlock(Terrain* terrian) {
     if (gridMarch(rayOrigin, rayDirection, mcr_terrain, &outDist, &outBlockHit)) {
         BlockType blockType = mcr_terrain.getBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z);
 
-        terrian->setBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z, EMPTY);
-        terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->destroyVBOdata();
-        terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->createVBOdata();
-        terrian->getChunkAt(outBlockHit.x, outBlockHit.z).get()->destroyVBOdata();
+        if (!terrian->editBlockAt(outBlockHit.x, outBlockHit.y, outBlockHit.z, EMPTY)) {
+            return EMPTY;
+        }
         std::cout << "remove block" << std::endl;
         return blockType;
     }
@@ -0,0 +1,391 @@
+#include "regionfile.h"
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <tuple>
+#include <unordered_set>
+
+static const uint32_t REGION_MAGIC = 0x47524d4d; // "MMRG"
+static const uint32_t REGION_VERSION = 2;
+static const size_t HEADER_BYTES = 8 + 8 * RegionFile::REGION_SIZE * RegionFile::REGION_SIZE;
+// save compacts a region file once garbage is over half of it,
+// unless it is smaller than this
+static const uint64_t COMPACT_MIN_BYTES = 256 * 1024;
+
+// Records start at multiples of this, so the words of the
+// BlockStorage in them are aligned in the mapped file
+static const uint64_t RECORD_ALIGNMENT = 8;
+
+// The header is little-endian whatever the machine is
+static void putU32(unsigned char *p, uint32_t v) {
+    p[0] = static_cast<unsigned char>(v);
+    p[1] = static_cast<unsigned char>(v >> 8);
+    p[2] = static_cast<unsigned char>(v >> 16);
+    p[3] = static_cast<unsigned char>(v >> 24);
+}
+
+static uint32_t getU32(const unsigned char *p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+struct RegionFile::Mapping {
+    QFile file;
+    uchar *data;
+    qint64 size;
+
+    explicit Mapping(const std::string &path)
+        : file(QString::fromStdString(path)), data(nullptr), size(0)
+    {
+        if (file.open(QIODevice::ReadOnly)) {
+            size = file.size();
+            data = size > 0 ? file.map(0, size) : nullptr;
+        }
+    }
+    ~Mapping() {
+        if (data) file.unmap(data);
+    }
+};
+
+RegionFile::RegionFile(const std::string &path)
+    : m_path(path), m_file(), m_entries(), m_fileSize(0), m_liveBytes(0), m_mapping()
+{
+    open();
+}
+
+// Renames the file at path out of the way, to path + suffix or, if that is
+// taken, path + suffix + ".1" and so on. Returns the new path, or an empty
+// string if it could not be renamed.
+static std::string setAside(const std::string &path, const std::string &suffix) {
+    std::string aside = path + suffix;
+    for (int i = 1; std::ifstream(aside).good(); i++) {
+        aside = path + suffix + "." + std::to_string(i);
+    }
+    if (std::rename(path.c_str(), aside.c_str()) != 0) return "";
+    return aside;
+}
+
+bool RegionFile::open() {
+    m_entries.fill(Entry{0, 0});
+    m_fileSize = 0;
+    m_liveBytes = 0;
+
+    std::vector<unsigned char> header(HEADER_BYTES, 0);
+    m_file.open(m_path, std::ios::in | std::ios::out | std::ios::binary);
+    if (m_file.is_open()) {
+        m_file.read(reinterpret_cast<char*>(header.data()), header.size());
+        bool readable = m_file && getU32(&header[0]) == REGION_MAGIC;
+        uint32_t version = readable ? getU32(&header[4]) : 0;
+        if (!readable || version != REGION_VERSION) {
+            // Set aside rather than overwritten, in case it can be recovered,
+            // and replaced with an empty region so its Chunks are saved again
+            m_file.close();
+            std::string aside = setAside(m_path, readable ? ".v" + std::to_string(version) + ".bak"
+                                                           : ".bad");
+            if (aside.empty()) {
+                std::cout << "region file " << m_path << " is not readable and cannot be moved, "
+                          << "its chunks will be generated and not saved" << std::endl;
+                return false;
+            }
+            std::cout << "region file " << m_path << (readable ? " is from an older version" : " is not readable")
+                      << ", moved to " << aside << " and its chunks will be generated" << std::endl;
+        }
+    }
+    if (!m_file.is_open()) {
+        // A new region: an empty header and no records
+        std::fill(header.begin(), header.end(), 0);
+        putU32(&header[0], REGION_MAGIC);
+        putU32(&header[4], REGION_VERSION);
+        std::ofstream created(m_path, std::ios::binary | std::ios::trunc);
+        created.write(reinterpret_cast<const char*>(header.data()), header.size());
+        if (!created) return false;
+        created.close();
+        m_file.open(m_path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!m_file.is_open()) return false;
+    }
+
+    m_file.seekg(0, std::ios::end);
+    m_fileSize = static_cast<uint64_t>(m_file.tellg());
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        Entry e{getU32(&header[8 + 8 * i]), getU32(&header[12 + 8 * i])};
+        // A record cut off by a crash is as good as none
+        if (e.length > 0 && e.offset >= HEADER_BYTES && uint64_t(e.offset) + e.length <= m_fileSize) {
+            m_entries[i] = e;
+            m_liveBytes += e.length;
+        }
+    }
+    return true;
+}
+
+bool RegionFile::isOpen() const {
+    return m_file.is_open();
+}
+
+bool RegionFile::has(int index) const {
+    return m_entries.at(index).length > 0;
+}
+
+bool RegionFile::writeEntry(int index) {
+    unsigned char bytes[8];
+    putU32(bytes, m_entries[index].offset);
+    putU32(bytes + 4, m_entries[index].length);
+    m_file.clear();
+    m_file.seekp(8 + 8 * index);
+    m_file.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+    m_file.flush();
+    return static_cast<bool>(m_file);
+}
+
+bool RegionFile::read(int index, std::vector<unsigned char> &out) {
+    const Entry &e = m_entries.at(index);
+    if (!isOpen() || e.length == 0) return false;
+    out.resize(e.length);
+    m_file.clear();
+    m_file.seekg(e.offset);
+    m_file.read(reinterpret_cast<char*>(out.data()), e.length);
+    return static_cast<bool>(m_file);
+}
+
+bool RegionFile::map(int index, RegionRecord &out) {
+    const Entry &e = m_entries.at(index);
+    if (!isOpen() || e.length == 0) return false;
+    if (!m_mapping || uint64_t(e.offset) + e.length > uint64_t(m_mapping->size)) {
+        m_mapping = std::make_shared<Mapping>(m_path);
+        if (!m_mapping->data || uint64_t(e.offset) + e.length > uint64_t(m_mapping->size)) {
+            return false;
+        }
+    }
+    out = RegionRecord{m_mapping, m_mapping->data + e.offset, e.length};
+    return true;
+}
+
+bool RegionFile::write(int index, const std::vector<unsigned char> &data) {
+    uint64_t padding = (RECORD_ALIGNMENT - m_fileSize % RECORD_ALIGNMENT) % RECORD_ALIGNMENT;
+    if (!isOpen() || data.empty() || m_fileSize + padding + data.size() > UINT32_MAX) return false;
+
+    // The record goes to disk before the header points at it
+    const char zeros[RECORD_ALIGNMENT] = {};
+    m_file.clear();
+    m_file.seekp(static_cast<std::streamoff>(m_fileSize));
+    m_file.write(zeros, padding);
+    m_fileSize += padding;
+    m_file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    m_file.flush();
+    if (!m_file) return false;
+
+    m_liveBytes -= m_entries.at(index).length;
+    m_entries[index] = Entry{static_cast<uint32_t>(m_fileSize), static_cast<uint32_t>(data.size())};
+    m_fileSize += data.size();
+    m_liveBytes += data.size();
+    return writeEntry(index);
+}
+
+uint64_t RegionFile::garbageBytes() const {
+    return m_fileSize < HEADER_BYTES ? 0 : m_fileSize - HEADER_BYTES - m_liveBytes;
+}
+
+uint64_t RegionFile::fileSize() const {
+    return m_fileSize;
+}
+
+bool RegionFile::compact() {
+    if (!isOpen()) return false;
+
+    // Written next to the file and renamed over it, so it is
+    // never left with only some of its records
+    std::string tmpPath = m_path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    std::vector<unsigned char> header(HEADER_BYTES, 0);
+    putU32(&header[0], REGION_MAGIC);
+    putU32(&header[4], REGION_VERSION);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+    uint32_t offset = static_cast<uint32_t>(HEADER_BYTES);
+    std::vector<unsigned char> record;
+    const char zeros[RECORD_ALIGNMENT] = {};
+    for (int i = 0; i < static_cast<int>(m_entries.size()); i++) {
+        if (!has(i)) continue;
+        if (!read(i, record)) {
+            out.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        uint32_t padding = (RECORD_ALIGNMENT - offset % RECORD_ALIGNMENT) % RECORD_ALIGNMENT;
+        out.write(zeros, padding);
+        offset += padding;
+        out.write(reinterpret_cast<const char*>(record.data()), record.size());
+        putU32(&header[8 + 8 * i], offset);
+        putU32(&header[12 + 8 * i], static_cast<uint32_t>(record.size()));
+        offset += static_cast<uint32_t>(record.size());
+    }
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    out.close();
+    if (!out) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    // Where the file cannot be replaced while it is mapped, Chunks still
+    // borrowing from it keep it as it is, and the new one is dropped.
+    // Elsewhere they keep the old file's pages after it is replaced.
+    m_file.close();
+    m_mapping.reset();
+    bool replaced = std::rename(tmpPath.c_str(), m_path.c_str()) == 0
+                    || (std::remove(m_path.c_str()) == 0
+                        && std::rename(tmpPath.c_str(), m_path.c_str()) == 0);
+    if (!replaced) {
+        std::remove(tmpPath.c_str());
+    }
+    return open() && replaced;
+}
+
+static int floorDiv(int a, int b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+RegionStore::RegionStore(const std::string &directory)
+    : m_directory(directory), m_lock(), m_regions(), m_recordsWritten(0),
+      m_queueLock(), m_queued()
+{
+    QDir().mkpath(QString::fromStdString(directory));
+}
+
+const std::string& RegionStore::directory() const {
+    return m_directory;
+}
+
+static int64_t chunkKey(int minX, int minZ) {
+    return static_cast<int64_t>(minX) << 32 | static_cast<uint32_t>(minZ);
+}
+
+// The coordinates of the region holding the Chunk with the given
+// corner, packed like chunkKey, and the Chunk's index in the region
+static int64_t regionKey(int minX, int minZ, int &index) {
+    int chunkX = floorDiv(minX, 16), chunkZ = floorDiv(minZ, 16);
+    int regionX = floorDiv(chunkX, RegionFile::REGION_SIZE);
+    int regionZ = floorDiv(chunkZ, RegionFile::REGION_SIZE);
+    index = (chunkX - regionX * RegionFile::REGION_SIZE)
+            + RegionFile::REGION_SIZE * (chunkZ - regionZ * RegionFile::REGION_SIZE);
+    return chunkKey(regionX, regionZ);
+}
+
+RegionFile* RegionStore::regionOf(int minX, int minZ, int &index) {
+    int64_t key = regionKey(minX, minZ, index);
+    uPtr<RegionFile> &region = m_regions[key];
+    if (!region) {
+        glm::ivec2 coords(static_cast<int>(key >> 32), static_cast<int>(key & 0xffffffff));
+        region = mkU<RegionFile>(m_directory + "/r." + std::to_string(coords.x)
+                                 + "." + std::to_string(coords.y) + ".region");
+    }
+    return region.get();
+}
+
+bool RegionStore::load(Chunk *c) {
+    // Checked before the files, since a flush only drops
+    // a snapshot once it has written it
+    std::shared_ptr<const Chunk::Snapshot> queued;
+    {
+        std::lock_guard<std::mutex> lock(m_queueLock);
+        auto it = m_queued.find(chunkKey(c->minX, c->minZ));
+        if (it != m_queued.end()) queued = it->second;
+    }
+
+    bool restored;
+    if (queued) {
+        std::vector<unsigned char> bytes;
+        restored = queued->serialize(bytes) && c->deserialize(bytes.data(), bytes.size());
+    } else {
+        RegionRecord record;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            int index;
+            RegionFile *region = regionOf(c->minX, c->minZ, index);
+            if (!region->map(index, record)) return false;
+        }
+        // The sections borrow their blocks from the mapping
+        restored = c->deserialize(record.data, record.size, record.mapping);
+    }
+    if (!restored) {
+        std::cout << "chunk at " << c->minX << ", " << c->minZ
+                  << " has a malformed record, generating it again" << std::endl;
+        return false;
+    }
+    return c->generationStage() == DECORATED;
+}
+
+void RegionStore::queue(std::shared_ptr<const Chunk::Snapshot> snapshot) {
+    std::lock_guard<std::mutex> lock(m_queueLock);
+    m_queued[chunkKey(snapshot->minX, snapshot->minZ)] = std::move(snapshot);
+}
+
+void RegionStore::flush() {
+    // Sorted by region and then index, so each
+    // region's records are appended together
+    std::vector<std::tuple<int64_t, int, std::shared_ptr<const Chunk::Snapshot>>> order;
+    {
+        std::lock_guard<std::mutex> lock(m_queueLock);
+        for (const auto &kv : m_queued) {
+            int index;
+            int64_t region = regionKey(kv.second->minX, kv.second->minZ, index);
+            order.push_back(std::make_tuple(region, index, kv.second));
+        }
+    }
+    std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) {
+        return std::make_pair(std::get<0>(a), std::get<1>(a)) < std::make_pair(std::get<0>(b), std::get<1>(b));
+    });
+
+    std::vector<unsigned char> record;
+    std::unordered_set<RegionFile*> written;
+    for (const auto &entry : order) {
+        const std::shared_ptr<const Chunk::Snapshot> &snapshot = std::get<2>(entry);
+        if (snapshot->serialize(record)) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            int index;
+            RegionFile *region = regionOf(snapshot->minX, snapshot->minZ, index);
+            if (region->write(index, record)) {
+                m_recordsWritten++;
+                written.insert(region);
+            } else {
+                std::cout << "could not save chunk at " << snapshot->minX << ", "
+                          << snapshot->minZ << std::endl;
+            }
+        }
+
+        // Unless a newer snapshot replaced it meanwhile
+        std::lock_guard<std::mutex> lock(m_queueLock);
+        auto it = m_queued.find(chunkKey(snapshot->minX, snapshot->minZ));
+        if (it != m_queued.end() && it->second == snapshot) {
+            m_queued.erase(it);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (RegionFile *region : written) {
+        if (region->fileSize() > COMPACT_MIN_BYTES && region->garbageBytes() > region->fileSize() / 2) {
+            region->compact();
+        }
+    }
+}
+
+size_t RegionStore::queuedCount() {
+    std::lock_guard<std::mutex> lock(m_queueLock);
+    return m_queued.size();
+}
+
+uint64_t RegionStore::recordsWritten() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_recordsWritten;
+}
+
+uint64_t RegionStore::diskUsage() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    uint64_t bytes = 0;
+    for (const auto &kv : m_regions) {
+        bytes += kv.second->fileSize();
+    }
+    return bytes;
+}
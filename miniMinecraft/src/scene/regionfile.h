@@ -0,0 +1,123 @@
+#pragma once
+#include "chunk.h"
+#include "smartpointerhelp.h"
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A record as it lies in a mapped region file. The mapping
+// stays valid, and the record unchanged, as long as it is held.
+struct RegionRecord {
+    std::shared_ptr<const void> mapping;
+    const unsigned char *data;
+    size_t size;
+};
+
+// The saved Chunks of one 32 x 32 Chunk area of the world, in one file.
+// The file starts with a header: a magic number and format version, then
+// the offset and length of every Chunk's record, both 0 for Chunks with
+// none. A record written again is appended to the end of the file and its
+// header entry pointed at it, so a crash mid-write leaves the old record
+// readable. The old one is left behind as garbage until compact() rewrites
+// the file with only the records the header points at.
+// A file of another format version, or that is not a region file, is
+// renamed with a .v<version>.bak or .bad suffix and replaced with an
+// empty region, so the Chunks in it are generated and saved again.
+// Records are read in place from a read-only mapping of the file. Since
+// they are never written over, Chunks can keep borrowing blocks from a
+// mapping after newer records have been appended to the file.
+class RegionFile {
+public:
+    // Chunks along each side of a region
+    static const int REGION_SIZE = 32;
+
+private:
+    struct Entry {
+        uint32_t offset, length;
+    };
+    struct Mapping;
+
+    std::string m_path;
+    std::fstream m_file;
+    std::array<Entry, REGION_SIZE * REGION_SIZE> m_entries;
+    uint64_t m_fileSize;
+    // The bytes of the records the header points at
+    uint64_t m_liveBytes;
+    // The file as far as it reached when last mapped, remapped
+    // when a record past its end is asked for
+    std::shared_ptr<Mapping> m_mapping;
+
+    bool open();
+    bool writeEntry(int index);
+
+public:
+    // Opens the file, creating it if it does not exist
+    explicit RegionFile(const std::string &path);
+
+    bool isOpen() const;
+    // index is the Chunk's position in the region, x + REGION_SIZE * z
+    bool has(int index) const;
+    // Both return false if the Chunk has no record or it cannot be read.
+    // read copies the record, map points out into the mapped file.
+    bool read(int index, std::vector<unsigned char> &out);
+    bool map(int index, RegionRecord &out);
+    bool write(int index, const std::vector<unsigned char> &data);
+    // The bytes of records that were written again since the last compact
+    uint64_t garbageBytes() const;
+    uint64_t fileSize() const;
+    // Returns false if the file is left as it was, which it may have to
+    // be while Chunks are borrowing from it on some systems
+    bool compact();
+};
+
+// The region files of one world, all in one directory and named
+// r.<x>.<z>.region after the region's coordinates in regions.
+// Chunks are saved by queueing snapshots of them, which a flush, usually
+// run by a SaveWorker, writes to their region files in batches.
+// Can be used from any thread.
+class RegionStore {
+private:
+    std::string m_directory;
+    // Guards the files. Held while writing and compacting them, so the
+    // queue has a lock of its own, and queueing never waits on the disk.
+    std::mutex m_lock;
+    // By the region x in the upper 32 bits and z in the lower 32 bits.
+    // Only opened when first used.
+    std::unordered_map<int64_t, uPtr<RegionFile>> m_regions;
+    uint64_t m_recordsWritten;
+
+    std::mutex m_queueLock;
+    // Snapshots waiting to be written, by the Chunk's minX in the upper
+    // 32 bits and minZ in the lower. A newer snapshot of a Chunk replaces
+    // the one waiting, so a Chunk changed many times is written once.
+    std::map<int64_t, std::shared_ptr<const Chunk::Snapshot>> m_queued;
+
+    // The region holding the Chunk with the given corner, and the
+    // Chunk's index in it. Must be called with m_lock held.
+    RegionFile* regionOf(int minX, int minZ, int &index);
+
+public:
+    explicit RegionStore(const std::string &directory);
+
+    const std::string& directory() const;
+    // Restores the Chunk from its queued snapshot or its record, see
+    // Chunk::deserialize. Returns whether its blocks were restored; a record
+    // of only the blocks its neighbors placed is restored too, but still
+    // returns false.
+    bool load(Chunk *c);
+    // Queues the snapshot to be written by the next flush
+    void queue(std::shared_ptr<const Chunk::Snapshot> snapshot);
+    // Writes the snapshots queued when it is called, a region at a time, and
+    // compacts the region files that are mostly garbage afterwards. Snapshots
+    // queued meanwhile wait for the next flush. One thread flushes at a time.
+    void flush();
+    size_t queuedCount();
+    uint64_t recordsWritten();
+    // The bytes of every region file opened so far
+    uint64_t diskUsage();
+};
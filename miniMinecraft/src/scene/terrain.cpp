@@ -2,16 +2,58 @@
 #include "cube.h"
 #include "scene/FBMWorker.h"
 #include "scene/VBOWorker.h"
+#include "scene/SaveWorker.h"
+#include "scene/SortWorker.h"
+#include "scene/chunkview.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
-#include <QThreadPool>
+#include <QElapsedTimer>
+
+// How many bytes of meshes checkThreadResults sends to the GPU per frame.
+// Crossing into a new zone finishes dozens of meshes at once, and uploading
+// them all in one frame stalls it.
+const size_t UPLOAD_BUDGET_BYTES = 2 * 1024 * 1024;
+// The default memory budget of the resident Chunks
+const size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+// Zones this close to the player are never evicted: the loaded radius
+// of 4, the ring of Chunks around it that decorating needs, and a margin
+// so walking back and forth across a zone border does not regenerate them
+const int EVICTION_KEEP_RADIUS = 6;
+// Where the region files of the world are kept
+const char *SAVE_DIRECTORY = "saves/world";
+// How often dirty Chunks are saved, and how many are snapshotted in one
+// frame; the rest follow once the SaveWorker has written those
+const qint64 AUTOSAVE_INTERVAL_MSECS = 5000;
+const size_t AUTOSAVE_BATCH_CHUNKS = 64;
+// Transparent quads are sorted in batches of this many Chunks, by at most
+// one SortWorker per SORT_WORKER_SHARE workers, so sorting never takes
+// more than a share of the workers from generation and meshing. Sorting a
+// Chunk takes microseconds, so that still covers the visible water within
+// a few frames of the camera moving.
+const size_t SORT_BATCH_CHUNKS = 16;
+const int SORT_WORKER_SHARE = 4;
 
 Terrain::Terrain(OpenGLContext *context)
-    : m_chunks(), m_generatedTerrain(), mp_context(context), m_texture(context), m_normalMap(context)
-{}
+    : m_arena(context), m_chunks(), m_generatedTerrain(), mp_context(context), m_memoryBudget(DEFAULT_MEMORY_BUDGET), m_zoneLastActive(), m_expandCount(0),
+      m_texture(context), m_normalMap(context), m_regions(SAVE_DIRECTORY),
+      m_saving(false), m_autosaveTimer(),
+      m_jobs(JobSystem::defaultWorkerCount())
+{
+    m_autosaveTimer.start();
+}
 
-Terrain::~Terrain() {}
+Terrain::~Terrain() {
+    m_jobs.waitForIdle();
+    // Evicted Chunks were saved when their blocks were released
+    for (const auto &kv : m_chunks) {
+        if (kv.second->hasBlockData() && kv.second->isDirty()) {
+            queueSave(kv.second.get());
+        }
+    }
+    m_regions.flush();
+}
 
 // Combine two 32-bit ints into one 64-bit int
 // where the upper 32 bits are X and the lower 32 bits are Z
@@ -31,6 +73,11 @@ int64_t toKey(int x, int z) {
     return xz;
 }
 
+int64_t zoneKeyOf(int x, int z) {
+    return toKey(64 * static_cast<int>(glm::floor(x / 64.f)),
+                 64 * static_cast<int>(glm::floor(z / 64.f)));
+}
+
 glm::ivec2 toCoords(int64_t k) {
     // Z is lower 32 bits
     int64_t z = k & 0x00000000ffffffff;
@@ -99,20 +146,67 @@ const uPtr<Chunk>& Terrain::getChunkAt(int x, int z) const {
     return m_chunks.at(toKey(16 * xFloor, 16 * zFloor));
 }
 
-void Terrain::setBlockAt(int x, int y, int z, BlockType t)
-{
-    if(hasChunkAt(x, z)) {
-        uPtr<Chunk> &c = getChunkAt(x, z);
-        glm::vec2 chunkOrigin = glm::vec2(floor(x / 16.f) * 16, floor(z / 16.f) * 16);
-        c->setBlockAt(static_cast<unsigned int>(x - chunkOrigin.x),
-                      static_cast<unsigned int>(y),
-                      static_cast<unsigned int>(z - chunkOrigin.y),
-                      t);
+bool Terrain::editBlockAt(int x, int y, int z, BlockType t) {
+    if (!hasChunkAt(x, z) || y < 0 || y >= 256) return false;
+    Chunk *c = getChunkAt(x, z).get();
+    if (c->generationStage() != DECORATED) return false;
+    // Jobs read and write the blocks on other threads. Edits waiting
+    // already go first, so edits are made in the order they came.
+    if (writerCount(c) > 0 || m_meshing.find(c) != m_meshing.end()
+        || m_pendingEdits.find(c) != m_pendingEdits.end()) {
+        m_pendingEdits[c].push_back(PendingEdit{x, y, z, t});
+        return true;
     }
-    else {
-        throw std::out_of_range("Coordinates " + std::to_string(x) +
-                                " " + std::to_string(y) + " " +
-                                std::to_string(z) + " have no Chunk!");
+
+    int lx = x - c->minX, lz = z - c->minZ;
+    c->setBlockAt(static_cast<unsigned int>(lx), static_cast<unsigned int>(y),
+                  static_cast<unsigned int>(lz), t);
+
+    // The faces that change are those of the block and its six neighbors
+    int sy = y / 16;
+    remeshEditedSection(c, sy);
+    if (y % 16 == 0 && sy > 0) remeshEditedSection(c, sy - 1);
+    if (y % 16 == 15 && sy < 15) remeshEditedSection(c, sy + 1);
+    if (lx == 0) remeshEditedSection(c->neighbor(XNEG), sy);
+    if (lx == 15) remeshEditedSection(c->neighbor(XPOS), sy);
+    if (lz == 0) remeshEditedSection(c->neighbor(ZNEG), sy);
+    if (lz == 15) remeshEditedSection(c->neighbor(ZPOS), sy);
+    return true;
+}
+
+void Terrain::applyPendingEdits() {
+    std::vector<Chunk*> ready;
+    for (const auto &kv : m_pendingEdits) {
+        Chunk *c = kv.first;
+        if (writerCount(c) == 0 && m_meshing.find(c) == m_meshing.end()) {
+            ready.push_back(c);
+        }
+    }
+    for (Chunk *c : ready) {
+        std::vector<PendingEdit> edits = std::move(m_pendingEdits[c]);
+        m_pendingEdits.erase(c);
+        // A mesh that finished meanwhile is from before the edits,
+        // so remeshEditedSection has the Chunk meshed again
+        for (const PendingEdit &e : edits) {
+            editBlockAt(e.x, e.y, e.z, e.type);
+        }
+    }
+}
+
+void Terrain::remeshEditedSection(Chunk *c, int sy) {
+    if (!c || c->generationStage() != DECORATED) return;
+    // A mesh being built or waiting for upload was built from the old
+    // blocks and would replace the patched one, and a stale one is
+    // wrong in more places than this section
+    bool pending = std::any_of(m_uploadQueue.begin(), m_uploadQueue.end(),
+                               [c](const MeshedChunk &mc) { return mc.mp_chunk == c; });
+    if (!pending && m_staleMeshes.find(c) == m_staleMeshes.end()
+        && canMesh(c) && c->remeshSection(sy)) {
+        return;
+    }
+    m_staleMeshes.insert(c);
+    if (canMesh(c) && m_activeZones.contains(zoneKeyOf(c->minX, c->minZ))) {
+        m_scheduler.scheduleMesh(c);
     }
 }
 
@@ -144,31 +238,98 @@ Chunk* Terrain::instantiateChunkAt(int x, int z) {
 // TODO: When you make Chunk inherit from Drawable, change this code so
 // it draws each Chunk with the given ShaderProgram, remembering to set the
 // model matrix to the proper X and Z translation!
-void Terrain::draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram) {
+void Terrain::draw(int minX, int maxX, int minZ, int maxZ, const glm::mat4 &viewProj,
+                   glm::vec3 eye, ShaderProgram *shaderProgram) {
+    QElapsedTimer timer;
+    timer.start();
     m_texture.bind(0); m_normalMap.bind(1);
 
+    Frustum frustum(viewProj);
+    double averageCpuNsecs = m_drawStats.averageCpuNsecs;
+    m_drawStats = DrawStats();
+    m_visibleChunks.clear();
     for (int x = minX; x < maxX; x += 16) {
         for (int z = minZ; z < maxZ; z += 16) {
-            bool has = hasChunkAt(x,z);
-            if (hasChunkAt(x, z)) {
-                const auto& chunk = getChunkAt(x, z);
-                chunk->sendVBOdata();
-
-                // proper X and Z translation done when creating VBO data
-                shaderProgram->drawInterleavedOpaque(*chunk);
+            auto it = m_chunks.find(toKey(x, z));
+            if (it == m_chunks.end()) continue;
+            Chunk *chunk = it->second.get();
+
+            glm::vec3 boxMin, boxMax;
+            if (!chunk->meshBounds(boxMin, boxMax)) continue;
+            if (!frustum.intersectsBox(boxMin, boxMax)) {
+                m_drawStats.chunksCulled++;
+                continue;
             }
+            m_visibleChunks.push_back(chunk);
         }
     }
+    m_drawStats.chunksDrawn = m_visibleChunks.size();
+
+    m_opaqueBatch.clear();
+    m_transparentBatch.clear();
+    m_transparentSections.clear();
+    for (Chunk *chunk : m_visibleChunks) {
+        if (chunk->opaqueCount() > 0) {
+            m_opaqueBatch.add(chunk->opaqueRange(), chunk->opaqueCount());
+        }
+        if (chunk->transparentCount() == 0) continue;
+        const std::array<SectionSlots, 16> &sections = chunk->mesh().transparentSlots;
+        for (int sy = 0; sy < 16; sy++) {
+            if (sections[sy].count == 0) continue;
+            glm::vec3 toCenter = glm::vec3(chunk->minX + 8, 16 * sy + 8, chunk->minZ + 8) - eye;
+            m_transparentSections.push_back({chunk, sy, glm::dot(toCenter, toCenter)});
+        }
+    }
+    // Farthest first, so nearer water and lava is blended over what lies behind it
+    std::sort(m_transparentSections.begin(), m_transparentSections.end(),
+              [](const TransparentSection &a, const TransparentSection &b) {
+        return a.distance > b.distance;
+    });
+    for (const TransparentSection &ts : m_transparentSections) {
+        const SectionSlots &section = ts.chunk->mesh().transparentSlots[ts.sy];
+        m_transparentBatch.add(ts.chunk->transparentRange(), 6 * section.count, section.first);
+    }
 
-    for (int x = minX; x < maxX; x += 16) {
-        for (int z = minZ; z < maxZ; z += 16) {
-            if (hasChunkAt(x, z)) {
-                const auto& chunk = getChunkAt(x, z);
-                // proper X and Z translation done when creating VBO data
-                shaderProgram->drawInterleavedTransparent(*chunk);
-            }
+    for (const ArenaBatch *batch : {&m_opaqueBatch, &m_transparentBatch}) {
+        if (batch->size() == 0) continue;
+        shaderProgram->drawArenaBatch(m_arena, *batch);
+        m_drawStats.drawCalls++;
+        m_drawStats.draws += batch->size();
+    }
+
+    sortTransparentQuads(eye);
+
+    m_drawStats.cpuNsecs = timer.nsecsElapsed();
+    m_drawStats.averageCpuNsecs = averageCpuNsecs == 0
+            ? m_drawStats.cpuNsecs
+            : averageCpuNsecs + (m_drawStats.cpuNsecs - averageCpuNsecs) / 32;
+}
+
+void Terrain::sortTransparentQuads(glm::vec3 eye) {
+    int idle = std::max(m_jobs.workerCount() / SORT_WORKER_SHARE, 1)
+               - m_jobs.unfinishedCount(SORT_JOB);
+    if (idle <= 0) return;
+
+    glm::ivec3 eyeBlock(glm::floor(eye));
+    std::vector<Chunk*> batch;
+    for (auto it = m_transparentSections.rbegin(); it != m_transparentSections.rend(); ++it) {
+        Chunk *c = it->chunk;
+        if (c->isSortedFor(eyeBlock) || m_sorting.find(c) != m_sorting.end()) continue;
+        m_sorting[c] = PendingSort{c->transparentVersion(), eyeBlock};
+        batch.push_back(c);
+        if (batch.size() == SORT_BATCH_CHUNKS) {
+            m_jobs.submit(SORT_JOB, mkU<SortWorker>(batch, eye, &m_jobs));
+            batch.clear();
+            if (--idle == 0) return;
         }
     }
+    if (!batch.empty()) {
+        m_jobs.submit(SORT_JOB, mkU<SortWorker>(batch, eye, &m_jobs));
+    }
+}
+
+const DrawStats& Terrain::drawStats() const {
+    return m_drawStats;
 }
 
 void Terrain::CreateTestScene()
@@ -221,14 +382,17 @@ void Terrain::CreateTestScene()
 }
 
 void Terrain::spawnVBOWorker(Chunk* c) {
-    VBOWorker * worker = new VBOWorker(c, &m_chunksThatHaveBlockData, &m_chunksThatHaveBlockDataLock);
-    QThreadPool::globalInstance()->start(worker);
-}
-
-void Terrain::spawnVBOWorkers(const std::unordered_set<Chunk*> &chunksNeedingVBOs) {
-    for (Chunk* c: chunksNeedingVBOs) {
-        spawnVBOWorker(c);
+    // Chunks that are not ready get meshed once the job
+    // in the way hands its Chunk back
+    if (!canMesh(c)) {
+        m_staleMeshes.insert(c);
+        return;
     }
+    m_staleMeshes.erase(c);
+    m_meshing.insert(c);
+
+    // The view copies the neighbors' borders here, on the main thread
+    m_jobs.submit(MESH_JOB, mkU<VBOWorker>(c, ChunkView(c), &m_jobs));
 }
 
 void Terrain::spawnFBMWorker(int64_t zone) {
@@ -250,29 +414,219 @@ void Terrain::spawnFBMWorker(int64_t zone) {
         }
     }
 
-    FBMWorker* worker = new FBMWorker(coords.x, coords.y, chunksForWorker,
-                                      &m_chunksThatHaveBlockData, &m_chunksThatHaveBlockDataLock);
+    // One job per Chunk, so a single zone keeps every worker busy.
+    // Decorating the zone's outer Chunks needs the base terrain of the
+    // ring of Chunks around it, which belong to zones that may not be
+    // generated; those are left undecorated until their zone is.
+    for (Chunk *c : chunksForWorker) {
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dz = -1; dz <= 1; dz++) {
+                Chunk *n = chunkNear(c, dx, dz);
+                if (!n) {
+                    n = instantiateChunkAt(c->minX + 16 * dx, c->minZ + 16 * dz);
+                }
+                requestBaseTerrain(n);
+            }
+        }
+    }
+    for (Chunk *c : chunksForWorker) {
+        if (c->generationStage() != DECORATED) {
+            m_awaitingDecoration.insert(c);
+            tryDecorate(c);
+        }
+    }
+}
+
+Chunk* Terrain::chunkNear(const Chunk *c, int dx, int dz) const {
+    auto it = m_chunks.find(toKey(c->minX + 16 * dx, c->minZ + 16 * dz));
+    return it == m_chunks.end() ? nullptr : it->second.get();
+}
+
+int Terrain::writerCount(Chunk *c) const {
+    auto it = m_writers.find(c);
+    return it == m_writers.end() ? 0 : it->second;
+}
+
+void Terrain::requestBaseTerrain(Chunk *c) {
+    // Only a base terrain job writes a Chunk that has no base terrain
+    if (c->generationStage() != NOT_GENERATED || writerCount(c) > 0) return;
+    m_writers[c]++;
+    m_jobs.submit(GENERATE_JOB, mkU<FBMWorker>(c, BASE_TERRAIN, &m_jobs, &m_regions));
+}
+
+void Terrain::tryDecorate(Chunk *c) {
+    if (m_awaitingDecoration.find(c) == m_awaitingDecoration.end()) {
+        return;
+    }
+    // Loaded already decorated from its region file
+    if (c->generationStage() == DECORATED) {
+        m_awaitingDecoration.erase(c);
+        return;
+    }
+    if (c->generationStage() != BASE_TERRAIN) {
+        return;
+    }
+
+    // Decorating writes the Chunk and its eight neighbors, which must
+    // all have their base terrain and nothing else reading or writing them
+    std::array<Chunk*, 9> area;
+    for (int i = 0; i < 9; i++) {
+        Chunk *n = chunkNear(c, i % 3 - 1, i / 3 - 1);
+        if (!n || n->generationStage() == NOT_GENERATED
+            || writerCount(n) > 0 || m_meshing.find(n) != m_meshing.end()) {
+            return;
+        }
+        area[i] = n;
+    }
+
+    m_awaitingDecoration.erase(c);
+    for (Chunk *n : area) {
+        m_writers[n]++;
+    }
+    m_jobs.submit(DECORATE_JOB, mkU<FBMWorker>(c, DECORATED, &m_jobs));
+}
+
+bool Terrain::canMesh(Chunk *c) const {
+    if (c->generationStage() != DECORATED || writerCount(c) > 0
+        || m_meshing.find(c) != m_meshing.end()) {
+        return false;
+    }
+    // ChunkView reads the neighbors' borders
+    for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+        Chunk *n = c->neighbor(dir);
+        if (n && writerCount(n) > 0) return false;
+    }
+    return true;
+}
+
+void Terrain::onJobCompleted(JobCompletion &done) {
+    Chunk *c = done.chunk;
+    auto release = [this](Chunk *n) {
+        if (--m_writers[n] == 0) m_writers.erase(n);
+    };
+
+    if (done.type == GENERATE_JOB) {
+        release(c);
+        if (c->generationStage() == DECORATED) m_staleMeshes.insert(c);
+        // Meshed Chunks next to it saw EMPTY blocks where its border is
+        for (Direction dir : {XPOS, XNEG, ZPOS, ZNEG}) {
+            Chunk *n = c->neighbor(dir);
+            if (n && n->generationStage() == DECORATED) m_staleMeshes.insert(n);
+        }
+    } else if (done.type == DECORATE_JOB) {
+        for (int i = 0; i < 9; i++) {
+            Chunk *n = chunkNear(c, i % 3 - 1, i / 3 - 1);
+            release(n);
+            if (n->generationStage() == DECORATED) m_staleMeshes.insert(n);
+        }
+    } else if (done.type == MESH_JOB) {
+        m_meshing.erase(c);
+        // Queue the meshes the VBOWorkers finished for upload
+        m_uploadQueue.push_back(MeshedChunk{c, std::move(done.mesh)});
+    } else if (done.type == SAVE_JOB) {
+        m_saving = false;
+        return;
+    } else if (done.type == SORT_JOB) {
+        // Dropped if the quads were meshed or patched again since they
+        // were copied, and sorted again once the Chunk is drawn
+        auto it = m_sorting.find(c);
+        c->setSortedTransparent(std::move(done.mesh.vboTransparent),
+                                it->second.version, it->second.eyeBlock);
+        m_sorting.erase(it);
+        return;
+    }
+
+    // Whatever the job kept from running is within two Chunks of it
+    for (int dx = -2; dx <= 2; dx++) {
+        for (int dz = -2; dz <= 2; dz++) {
+            Chunk *n = chunkNear(c, dx, dz);
+            if (!n) continue;
+            tryDecorate(n);
+            // Chunks whose zone has left the loaded radius
+            // get meshed if it comes back.
+            if (m_staleMeshes.find(n) != m_staleMeshes.end() && canMesh(n)
+                && m_activeZones.contains(zoneKeyOf(n->minX, n->minZ))) {
+                m_scheduler.scheduleMesh(n);
+            }
+        }
+    }
+}
 
-    QThreadPool::globalInstance()->start(worker);
 
+void Terrain::dispatchScheduledWork(glm::vec3 playerPos, glm::vec3 viewDir) {
+    // Saving and sorting run alongside and are kept to a few workers
+    // themselves, so only the streaming work counts against the workers
+    int idle = m_jobs.workerCount() - m_jobs.unfinishedCount(GENERATE_JOB)
+               - m_jobs.unfinishedCount(DECORATE_JOB) - m_jobs.unfinishedCount(MESH_JOB);
+    if (idle <= 0) return;
+
+    for (const ChunkScheduler::Task &t : m_scheduler.takeNext(playerPos, viewDir, idle)) {
+        if (t.type == ChunkScheduler::GENERATE_ZONE) {
+            spawnFBMWorker(t.zone);
+        } else {
+            spawnVBOWorker(t.chunk);
+        }
+    }
 }
 
+void Terrain::checkThreadResults(glm::vec3 playerPos, glm::vec3 viewDir) {
+    for (JobCompletion &done : m_jobs.takeCompleted()) {
+        onJobCompleted(done);
+    }
+    if (!m_pendingEdits.empty()) applyPendingEdits();
 
-void Terrain::checkThreadResults() {
-    // for the new generated chunk, build their VBO data
-    // by VBOWorkers
-    m_chunksThatHaveBlockDataLock.lock();
-    spawnVBOWorkers(m_chunksThatHaveBlockData);
-    m_chunksThatHaveBlockData.clear();
-    m_chunksThatHaveBlockDataLock.unlock();
+    dispatchScheduledWork(playerPos, viewDir);
+    autosave();
 
     // Send the Chunk VBOData to GPU
-    m_chunksThatHaveVBOsLock.lock() ;
-    for (Chunk* &ck : m_chunksThatHaveVBOs) {
-        ck->sendVBOdata();
+    uploadMeshes();
+}
+
+void Terrain::queueSave(Chunk *c) {
+    std::shared_ptr<const Chunk::Snapshot> snapshot = c->snapshot();
+    c->markSaved(snapshot->generation);
+    m_regions.queue(std::move(snapshot));
+}
+
+void Terrain::autosave() {
+    if (m_saving) return;
+
+    // Evicted Chunks are written as soon as possible,
+    // the others once the interval has passed
+    if (m_regions.queuedCount() == 0) {
+        if (m_autosaveTimer.elapsed() < AUTOSAVE_INTERVAL_MSECS) return;
+        size_t count = 0;
+        for (const auto &kv : m_chunks) {
+            Chunk *c = kv.second.get();
+            if (!c->hasBlockData() || !c->isDirty() || writerCount(c) > 0) continue;
+            queueSave(c);
+            if (++count == AUTOSAVE_BATCH_CHUNKS) break;
+        }
+        if (count < AUTOSAVE_BATCH_CHUNKS) {
+            m_autosaveTimer.restart();
+        }
+        if (count == 0) return;
+    }
+
+    m_saving = true;
+    m_jobs.submit(SAVE_JOB, mkU<SaveWorker>(&m_regions, &m_jobs));
+}
+
+void Terrain::uploadMeshes() {
+    // Always upload at least one mesh, however large, so the queue drains
+    size_t bytes = 0;
+    while (!m_uploadQueue.empty() && bytes < UPLOAD_BUDGET_BYTES) {
+        MeshedChunk &mc = m_uploadQueue.front();
+        // Meshed after its zone left the loaded radius
+        if (!m_activeZones.contains(zoneKeyOf(mc.mp_chunk->minX, mc.mp_chunk->minZ))) {
+            m_uploadQueue.pop_front();
+            continue;
+        }
+        bytes += mc.m_mesh.byteSize();
+        mc.mp_chunk->setVBOdata(std::move(mc.m_mesh));
+        mc.mp_chunk->sendVBOdata(m_arena);
+        m_uploadQueue.pop_front();
     }
-    m_chunksThatHaveVBOs.clear();
-    m_chunksThatHaveVBOsLock.unlock() ;
 }
 
 // The terrian zone based on postion and radius
@@ -289,7 +643,7 @@ QSet<int64_t> Terrain::getTerrainZones(glm::ivec2 zoneCoords, unsigned int radiu
     return result;
 }
 
-void Terrain::expandChunks(glm::vec3 playerPos, glm::vec3 playerPosPrev) {
+void Terrain::expandChunks(glm::vec3 playerPos, glm::vec3 playerPosPrev, glm::vec3 viewDir) {
     // multi thread for expansion
     glm::ivec2 currZone(64 * glm::floor(playerPos.x / 64.f),
                         64 * glm::floor(playerPos.z / 64.f));
@@ -315,6 +669,17 @@ void Terrain::expandChunks(glm::vec3 playerPos, glm::vec3 playerPosPrev) {
         }
     }
 
+    // Work that has not started for zones that left is dropped
+    m_scheduler.cancelOutside(terrainZonesCur);
+    m_activeZones = terrainZonesCur;
+    m_expandCount++;
+    for (auto id : terrainZonesCur) {
+        m_zoneLastActive[id] = m_expandCount;
+    }
+    if (currZone != prevZone) {
+        evictToBudget(currZone);
+    }
+
     // For the current terrian zone, if no Chunk then generated it
     // If has Chunk but no VBOData inside, fill the VBOData
     for (auto id : terrainZonesCur) {
@@ -323,22 +688,139 @@ void Terrain::expandChunks(glm::vec3 playerPos, glm::vec3 playerPosPrev) {
             if (!terrainZonesPrev.contains(id)) {
                 for (int x = coord.x; x < coord.x + 64; x += 16) {
                     for (int z = coord.y; z < coord.y + 64; z += 16) {
-                        auto chunk = getChunkAt(x, z).get();
-                        spawnVBOWorker(chunk);
+                        m_scheduler.scheduleMesh(getChunkAt(x, z).get());
                     }
                 }
             }
         }
         else {
-            spawnFBMWorker(id);
+            m_scheduler.scheduleZone(id);
         }
     }
 
     // last step to fill data and send to GPU
-    checkThreadResults();
+    checkThreadResults(playerPos, viewDir);
+
+
 
+}
+
+void Terrain::setMeshingMode(MeshingMode mode, glm::vec3 playerPos) {
+    Chunk::setMeshingMode(mode);
+
+    glm::ivec2 currZone(64 * glm::floor(playerPos.x / 64.f),
+                        64 * glm::floor(playerPos.z / 64.f));
+    for (auto id : getTerrainZones(currZone, 4)) {
+        if (m_generatedTerrain.find(id) == m_generatedTerrain.end()) continue;
+        glm::ivec2 coord = toCoords(id);
+        for (int x = coord.x; x < coord.x + 64; x += 16) {
+            for (int z = coord.y; z < coord.y + 64; z += 16) {
+                auto chunk = getChunkAt(x, z).get();
+                chunk->destroyVBOdata();
+                m_scheduler.scheduleMesh(chunk);
+            }
+        }
+    }
+}
+
+void Terrain::setMemoryBudget(size_t bytes) {
+    m_memoryBudget = bytes;
+}
+
+size_t Terrain::memoryBudget() const {
+    return m_memoryBudget;
+}
+
+size_t Terrain::residentChunkCount() const {
+    size_t count = 0;
+    for (const auto &kv : m_chunks) {
+        if (kv.second->hasBlockData()) count++;
+    }
+    return count;
+}
 
+size_t Terrain::residentBytes() const {
+    size_t bytes = 0;
+    for (const auto &kv : m_chunks) {
+        if (kv.second->hasBlockData()) bytes += kv.second->residentMemoryUsage();
+    }
+    return bytes;
+}
 
+bool Terrain::canEvictZone(int64_t zone) const {
+    glm::ivec2 coord = toCoords(zone);
+    for (int x = coord.x - 16; x < coord.x + 80; x += 16) {
+        for (int z = coord.y - 16; z < coord.y + 80; z += 16) {
+            auto it = m_chunks.find(toKey(x, z));
+            if (it == m_chunks.end()) continue;
+            Chunk *c = it->second.get();
+            bool inZone = x >= coord.x && x < coord.x + 64 && z >= coord.y && z < coord.y + 64;
+            if (inZone && (m_writers.find(c) != m_writers.end()
+                           || m_meshing.find(c) != m_meshing.end()
+                           || m_pendingEdits.find(c) != m_pendingEdits.end())) {
+                return false;
+            }
+            // Would wait for base terrain nothing is going to generate again
+            if (!inZone && m_awaitingDecoration.find(c) != m_awaitingDecoration.end()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Terrain::evictToBudget(glm::ivec2 currZone) {
+    size_t bytes = residentBytes();
+    if (bytes <= m_memoryBudget) return;
+
+    // Zones holding blocks that are out of the keep radius,
+    // with the bytes their Chunks use
+    std::unordered_map<int64_t, size_t> candidates;
+    for (const auto &kv : m_chunks) {
+        const Chunk *c = kv.second.get();
+        if (!c->hasBlockData()) continue;
+        int64_t zone = zoneKeyOf(c->minX, c->minZ);
+        glm::ivec2 coord = toCoords(zone);
+        if (glm::abs(coord.x - currZone.x) / 64 > EVICTION_KEEP_RADIUS
+            || glm::abs(coord.y - currZone.y) / 64 > EVICTION_KEEP_RADIUS) {
+            candidates[zone] += c->residentMemoryUsage();
+        }
+    }
+
+    std::vector<int64_t> order;
+    for (const auto &kv : candidates) {
+        order.push_back(kv.first);
+    }
+    // Zones that were never loaded, only the ring around loaded
+    // ones, have no entry and go first
+    auto lastActive = [this](int64_t zone) {
+        auto it = m_zoneLastActive.find(zone);
+        return it == m_zoneLastActive.end() ? 0 : it->second;
+    };
+    std::sort(order.begin(), order.end(), [&](int64_t a, int64_t b) {
+        return lastActive(a) < lastActive(b);
+    });
+
+    for (int64_t zone : order) {
+        if (bytes <= m_memoryBudget) break;
+        if (!canEvictZone(zone)) continue;
+
+        glm::ivec2 coord = toCoords(zone);
+        for (int x = coord.x; x < coord.x + 64; x += 16) {
+            for (int z = coord.y; z < coord.y + 64; z += 16) {
+                if (!hasChunkAt(x, z)) continue;
+                Chunk *c = getChunkAt(x, z).get();
+                if (!c->hasBlockData()) continue;
+                if (c->isDirty()) queueSave(c);
+                c->releaseBlockData();
+                m_awaitingDecoration.erase(c);
+                m_staleMeshes.erase(c);
+            }
+        }
+        bytes -= candidates[zone];
+        m_generatedTerrain.erase(zone);
+        m_zoneLastActive.erase(zone);
+    }
 }
 
 void Terrain::instantiateTexture() {
@@ -349,3 +831,7 @@ void Terrain::instantiateTexture() {
     m_normalMap.create(":/textures/minecraft_normals_all.png");
     m_normalMap.load(1);
 }
+
+void Terrain::createArena() {
+    m_arena.create();
+}
@@ -7,7 +7,12 @@
 #include <unordered_set>
 #include "shaderprogram.h"
 #include "texture.h"
-#include <QMutex>
+#include "scene/chunkscheduler.h"
+#include "scene/jobsystem.h"
+#include "scene/regionfile.h"
+#include "scene/frustum.h"
+#include <deque>
+#include <QElapsedTimer>
 
 
 //using namespace std;
@@ -15,6 +20,32 @@
 // Helper functions to convert (x, z) to and from hash map key
 int64_t toKey(int x, int z);
 glm::ivec2 toCoords(int64_t k);
+// The key of the terrain generation zone holding world-space (x, z)
+int64_t zoneKeyOf(int x, int z);
+
+// A mesh a VBOWorker built, waiting for the main thread to upload it
+struct MeshedChunk
+{
+    Chunk * mp_chunk;
+    ChunkMesh m_mesh;
+};
+
+// What the last Terrain::draw drew
+struct DrawStats
+{
+    // Multi-draws, and the draws they were made of: one for every Chunk in
+    // the opaque pass, and one for every section in the transparent one
+    int drawCalls = 0;
+    int draws = 0;
+    // Chunks with an uploaded mesh inside the range it was asked to draw,
+    // split into those in the view frustum and those outside it
+    int chunksDrawn = 0;
+    int chunksCulled = 0;
+    // The CPU time the draw took, most of it spent handing commands to the
+    // driver, and its average over the last frames
+    qint64 cpuNsecs = 0;
+    double averageCpuNsecs = 0;
+};
 
 // The container class for all of the Chunks in the game.
 // Ultimately, while Terrain will always store all Chunks,
@@ -22,6 +53,10 @@ glm::ivec2 toCoords(int64_t k);
 // expands.
 class Terrain {
 private:
+    // Holds the uploaded meshes of all the Chunks. Declared before them,
+    // since they give their ranges back when destroyed.
+    TerrainArena m_arena;
+
     // Stores every Chunk according to the location of its lower-left corner
     // in world space.
     // We combine the X and Z coordinates of the Chunk's corner into one 64-bit int
@@ -48,23 +83,130 @@ private:
 
 
     // shared memory
-    // VBO data to the main thread
-    std::unordered_set<Chunk*> m_chunksThatHaveBlockData;
-    QMutex m_chunksThatHaveBlockDataLock;
-    std::vector<Chunk*> m_chunksThatHaveVBOs;
-    QMutex m_chunksThatHaveVBOsLock;
+    // Chunks go through three stages: FBMWorkers generate each Chunk's base
+    // terrain, then decorate it once all eight of its neighbors have theirs,
+    // and report back to the main thread through m_jobs' completions. It
+    // gives decorated Chunks to VBOWorkers, which hand the meshes they
+    // build back the same way, and uploads those from m_uploadQueue, at
+    // most UPLOAD_BUDGET_BYTES per frame.
+    // The rest of this is only touched by the main thread.
+    std::deque<MeshedChunk> m_uploadQueue;
+
+    // Jobs whose blocks overlap never run at once. These count the jobs
+    // writing each Chunk's blocks: its base terrain job, and the decorate
+    // jobs of it and its eight neighbors. Chunks with no writers are absent.
+    std::unordered_map<Chunk*, int> m_writers;
+    // Chunks a VBOWorker is reading
+    std::unordered_set<Chunk*> m_meshing;
+    // Chunks of generated zones that have not been given a decorate job
+    std::unordered_set<Chunk*> m_awaitingDecoration;
+    // Chunks whose blocks, or whose neighbors' borders, changed after
+    // they were last meshed, or that could not be meshed when asked
+    std::unordered_set<Chunk*> m_staleMeshes;
+    // Edits to decorated Chunks a job was using at the time, oldest
+    // first, made once the jobs using them have finished
+    struct PendingEdit {
+        int x, y, z;
+        BlockType type;
+    };
+    std::unordered_map<Chunk*, std::vector<PendingEdit>> m_pendingEdits;
+
+    // Generation and meshing work waiting for a free worker thread
+    ChunkScheduler m_scheduler;
+    // The zones within the loaded radius of the player
+    QSet<int64_t> m_activeZones;
+
+    // The most memory the blocks and CPU-side meshes of the resident
+    // Chunks may use before zones far from the player are evicted
+    size_t m_memoryBudget;
+    // When each zone was last within the loaded radius, in expandChunks
+    // calls, so the zones left longest ago are evicted first
+    std::unordered_map<int64_t, uint64_t> m_zoneLastActive;
+    uint64_t m_expandCount;
 
     // multi-threading part
     void spawnVBOWorker(Chunk* c);
-    void spawnVBOWorkers(const std::unordered_set<Chunk*> &chunksNeedingVBOs);
-    void spawnFBMWorkers(const QSet<int64_t> &zonesToGenerate);
     void spawnFBMWorker(int64_t zone);
+    // The Chunk dx, dz Chunks away from c, or nullptr
+    Chunk* chunkNear(const Chunk *c, int dx, int dz) const;
+    int writerCount(Chunk *c) const;
+    // Starts generating the base terrain of the Chunk, unless it
+    // has been or is being generated
+    void requestBaseTerrain(Chunk *c);
+    // Starts decorating the Chunk if it is waiting to be and
+    // nothing around it is in the way
+    void tryDecorate(Chunk *c);
+    // Whether the Chunk is decorated and nothing is writing its blocks,
+    // or the borders of its neighbors, or already meshing it
+    bool canMesh(Chunk *c) const;
+    // Updates the bookkeeping above for a finished job, and starts
+    // the work that was waiting for it
+    void onJobCompleted(JobCompletion &done);
+    // Whether the zone's Chunks can be released without
+    // disturbing jobs or decorations that need them
+    bool canEvictZone(int64_t zone) const;
+    // Releases the least recently loaded zones more than
+    // EVICTION_KEEP_RADIUS zones away until the budget is met
+    void evictToBudget(glm::ivec2 currZone);
+    // Hands the most urgent scheduled work to the idle worker threads
+    void dispatchScheduledWork(glm::vec3 playerPos, glm::vec3 viewDir);
+    // Sends queued meshes to the GPU until this frame's budget is spent
+    void uploadMeshes();
+    // Patches section sy of the Chunk's mesh after an edit, or has the
+    // whole Chunk meshed again if its mesh cannot be patched
+    void remeshEditedSection(Chunk *c, int sy);
+    // Makes the queued edits of the Chunks no job is using any more
+    void applyPendingEdits();
     // The textures used to give the appearance of different types of blocks
     Texture m_texture;
     Texture m_normalMap;
+    // The Chunks the current draw call found in the frustum, kept
+    // between frames so its storage is reused
+    std::vector<Chunk*> m_visibleChunks;
+    ArenaBatch m_opaqueBatch, m_transparentBatch;
+    DrawStats m_drawStats;
+    // A section of a visible Chunk with transparent quads, and the squared
+    // distance from the camera to its center
+    struct TransparentSection {
+        Chunk *chunk;
+        int sy;
+        float distance;
+    };
+    // The transparent pass is drawn one section at a time, from the
+    // farthest to the nearest, each with its quads sorted the same way
+    std::vector<TransparentSection> m_transparentSections;
+    // The Chunks whose transparent quads a SortWorker is sorting, with the
+    // version of them it copied and the block the camera was in
+    struct PendingSort {
+        uint64_t version;
+        glm::ivec3 eyeBlock;
+    };
+    std::unordered_map<Chunk*, PendingSort> m_sorting;
+    // Has the transparent quads of the visible Chunks sorted again on the
+    // worker threads if the camera moved into another block since, the
+    // nearest first, in batches of SORT_BATCH_CHUNKS by a few workers
+    void sortTransparentQuads(glm::vec3 eye);
+
+    // Where Chunks are saved, and loaded from instead of generated when
+    // they are needed again. Dirty Chunks are snapshotted every
+    // AUTOSAVE_INTERVAL_MSECS, when they are evicted and when the game
+    // closes, and a SaveWorker writes the snapshots in the background.
+    RegionStore m_regions;
+    // Whether a SaveWorker is running
+    bool m_saving;
+    QElapsedTimer m_autosaveTimer;
+    // Queues a snapshot of the Chunk, which no job may be writing
+    void queueSave(Chunk *c);
+    // Snapshots dirty Chunks and starts a SaveWorker, if it is time to
+    void autosave();
+
+    // The worker threads. Declared after the Chunks its jobs
+    // write to, so it is destroyed, and its threads stopped, first.
+    JobSystem m_jobs;
 
 public:
     Terrain(OpenGLContext *context);
+    // Saves every Chunk that holds blocks
     ~Terrain();
 
     // Instantiates a new Chunk and stores it in
@@ -84,25 +226,47 @@ public:
     // values) return the block stored at that point in space.
     BlockType getBlockAt(int x, int y, int z) const;
     BlockType getBlockAt(glm::vec3 p) const;
-    // Given a world-space coordinate (which may have negative
-    // values) set the block at that point in space to the
-    // given type.
-    void setBlockAt(int x, int y, int z, BlockType t);
+    // Sets a block the player placed or broke, and patches the meshes of
+    // the sections whose faces it changes, those of neighboring Chunks
+    // included, in place. If a job is using the Chunk's blocks the edit is
+    // queued, and made when the next frame finds the job finished. Returns
+    // false, changing nothing, if the Chunk has not been decorated.
+    bool editBlockAt(int x, int y, int z, BlockType t);
 
     // Draws every Chunk that falls within the bounding box
-    // described by the min and max coords, using the provided
-    // ShaderProgram
-    void draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram);
+    // described by the min and max coords and whose mesh lies in
+    // the view frustum of viewProj, using the provided ShaderProgram.
+    // Transparent quads are drawn back to front as seen from eye.
+    void draw(int minX, int maxX, int minZ, int maxZ, const glm::mat4 &viewProj,
+              glm::vec3 eye, ShaderProgram *shaderProgram);
+    const DrawStats& drawStats() const;
 
     // Initializes the Chunks that store the 64 x 256 x 64 block scene you
     // see when the base code is run.
     void CreateTestScene();
 
-    void expandChunks(glm::vec3 playerPos, glm::vec3 playerPosPrev);
+    // viewDir is the direction the camera looks in, so that
+    // work in front of the player is scheduled first
+    void expandChunks(glm::vec3 playerPos, glm::vec3 playerPosPrev, glm::vec3 viewDir);
 
     // milestone 2: multi-threading
-    void checkThreadResults();
+    void checkThreadResults(glm::vec3 playerPos, glm::vec3 viewDir);
     void instantiateTexture();
+    // Creates the buffers the Chunks' meshes are uploaded to.
+    // Must be called with the context current, before any upload.
+    void createArena();
     QSet<int64_t> getTerrainZones(glm::ivec2 zoneCoords, unsigned int radius);
 
+    // Switches every Chunk to the given mesher and rebuilds
+    // the VBO data of the zones surrounding the player
+    void setMeshingMode(MeshingMode mode, glm::vec3 playerPos);
+
+    // Zones evicted to stay within the budget are saved to their
+    // region files and loaded from them when the player returns
+    void setMemoryBudget(size_t bytes);
+    size_t memoryBudget() const;
+    // The Chunks that hold blocks, and the bytes they use, see Chunk::residentMemoryUsage
+    size_t residentChunkCount() const;
+    size_t residentBytes() const;
+
 };
@@ -0,0 +1,248 @@
+#include "terrainarena.h"
+#include "chunk.h"
+#include <QOpenGLContext>
+#include <algorithm>
+#include <iostream>
+
+// The pages the arena starts with, 8 MiB of vertices
+const uint32_t INITIAL_PAGES = 8 * TerrainArena::PAGE_ROW;
+
+uint32_t ArenaRange::firstVertex() const {
+    return firstPage * TerrainArena::PAGE_VERTICES;
+}
+
+uint32_t ArenaRange::capacity() const {
+    return pageCount * TerrainArena::PAGE_VERTICES;
+}
+
+void ArenaBatch::clear() {
+    counts.clear();
+    baseVertices.clear();
+    offsets.clear();
+}
+
+void ArenaBatch::add(const ArenaRange &range, GLsizei indexCount, uint32_t firstQuad) {
+    counts.push_back(indexCount);
+    baseVertices.push_back(static_cast<GLint>(range.firstVertex()));
+    // Every quad takes 6 indices
+    offsets.push_back(reinterpret_cast<const void*>(size_t(6) * firstQuad * sizeof(GLuint)));
+}
+
+size_t ArenaBatch::size() const {
+    return counts.size();
+}
+
+TerrainArena::TerrainArena(OpenGLContext *context)
+    : mp_context(context), m_created(false), m_vbo(0), m_ibo(0), m_pageTexture(0),
+      m_vao(0), m_vaoBuffer(0), m_vaoAttribute(-1),
+      m_multiDraw(nullptr), m_pageCapacity(0), m_pagesUsed(0), m_free(), m_pageOrigins(),
+      m_dirtyRowsBegin(0), m_dirtyRowsEnd(0), m_textureRows(0), m_indexQuads(0)
+{}
+
+TerrainArena::~TerrainArena() {
+    destroy();
+}
+
+void TerrainArena::create() {
+    if (m_created) return;
+    m_created = true;
+    m_multiDraw = reinterpret_cast<MultiDrawElementsBaseVertex>(
+        mp_context->context()->getProcAddress("glMultiDrawElementsBaseVertex"));
+    if (!m_multiDraw) {
+        std::cout << "glMultiDrawElementsBaseVertex is not available, terrain will not be drawn" << std::endl;
+    }
+
+    mp_context->glGenBuffers(1, &m_ibo);
+    mp_context->glGenTextures(1, &m_pageTexture);
+    mp_context->glGenVertexArrays(1, &m_vao);
+    if (m_pageCapacity < INITIAL_PAGES) {
+        grow(INITIAL_PAGES);
+    } else {
+        reallocateBuffer(0);
+    }
+    m_indexQuads = std::max(m_indexQuads, INITIAL_PAGES / 8 * PAGE_VERTICES / 4);
+    uploadIndices();
+}
+
+void TerrainArena::destroy() {
+    if (!m_created) return;
+    mp_context->glDeleteBuffers(1, &m_vbo);
+    mp_context->glDeleteBuffers(1, &m_ibo);
+    mp_context->glDeleteTextures(1, &m_pageTexture);
+    mp_context->glDeleteVertexArrays(1, &m_vao);
+    m_vbo = m_ibo = m_pageTexture = m_vao = m_vaoBuffer = 0;
+    m_vaoAttribute = -1;
+    m_created = false;
+    m_textureRows = 0;
+}
+
+void TerrainArena::reallocateBuffer(uint32_t oldPages) {
+    if (!m_created) return;
+    // Copied over on the GPU, so the ranges stay where they are
+    GLuint vbo;
+    mp_context->glGenBuffers(1, &vbo);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    mp_context->glBufferData(GL_COPY_WRITE_BUFFER, size_t(m_pageCapacity) * PAGE_VERTICES * sizeof(Vertex),
+                             nullptr, GL_DYNAMIC_DRAW);
+    if (m_vbo != 0) {
+        mp_context->glBindBuffer(GL_COPY_READ_BUFFER, m_vbo);
+        mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                        size_t(oldPages) * PAGE_VERTICES * sizeof(Vertex));
+        mp_context->glDeleteBuffers(1, &m_vbo);
+    }
+    m_vbo = vbo;
+    // The name may be the one of a buffer deleted before
+    m_vaoBuffer = 0;
+}
+
+void TerrainArena::grow(uint32_t pages) {
+    uint32_t oldCapacity = m_pageCapacity;
+    uint32_t capacity = std::max(2 * oldCapacity, pages);
+    capacity = (capacity + PAGE_ROW - 1) / PAGE_ROW * PAGE_ROW;
+
+    // The new pages join the free run at the end, if there is one
+    uint32_t first = oldCapacity;
+    if (!m_free.empty()) {
+        auto last = std::prev(m_free.end());
+        if (last->first + last->second == oldCapacity) {
+            first = last->first;
+            m_free.erase(last);
+        }
+    }
+    m_free[first] = capacity - first;
+
+    m_pageCapacity = capacity;
+    m_pageOrigins.resize(capacity);
+    reallocateBuffer(oldCapacity);
+}
+
+void TerrainArena::reserveIndices(uint32_t quads) {
+    if (quads <= m_indexQuads) return;
+    m_indexQuads = std::max(quads, 2 * m_indexQuads);
+    uploadIndices();
+}
+
+void TerrainArena::uploadIndices() {
+    if (!m_created) return;
+    std::vector<GLuint> idx;
+    idx.reserve(6 * size_t(m_indexQuads));
+    for (GLuint q = 0; q < m_indexQuads; q++) {
+        for (GLuint i : {0, 1, 2, 0, 2, 3}) {
+            idx.push_back(4 * q + i);
+        }
+    }
+    // Not bound as the element buffer, which would change the bound vertex array object
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, m_ibo);
+    mp_context->glBufferData(GL_COPY_WRITE_BUFFER, idx.size() * sizeof(GLuint), idx.data(), GL_STATIC_DRAW);
+}
+
+ArenaRange TerrainArena::allocate(uint32_t vertices, glm::ivec2 origin) {
+    ArenaRange range;
+    if (vertices == 0) return range;
+    uint32_t pages = (vertices + PAGE_VERTICES - 1) / PAGE_VERTICES;
+
+    // First fit, which keeps the used pages packed towards the start
+    auto it = m_free.begin();
+    while (it != m_free.end() && it->second < pages) ++it;
+    if (it == m_free.end()) {
+        grow(m_pageCapacity + pages);
+        it = std::prev(m_free.end());
+    }
+
+    range.firstPage = it->first;
+    range.pageCount = pages;
+    if (it->second > pages) {
+        m_free[it->first + pages] = it->second - pages;
+    }
+    m_free.erase(it);
+    m_pagesUsed += pages;
+
+    std::fill_n(m_pageOrigins.begin() + range.firstPage, pages, origin);
+    m_dirtyRowsBegin = std::min(m_dirtyRowsBegin, range.firstPage / PAGE_ROW);
+    m_dirtyRowsEnd = std::max(m_dirtyRowsEnd, (range.firstPage + pages - 1) / PAGE_ROW + 1);
+
+    reserveIndices(vertices / 4);
+    return range;
+}
+
+void TerrainArena::release(ArenaRange &range) {
+    if (range.pageCount == 0) return;
+    uint32_t first = range.firstPage, count = range.pageCount;
+    m_pagesUsed -= count;
+    range = ArenaRange();
+
+    // Merge with the free runs on either side
+    auto next = m_free.lower_bound(first);
+    if (next != m_free.end() && next->first == first + count) {
+        count += next->second;
+        next = m_free.erase(next);
+    }
+    if (next != m_free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == first) {
+            prev->second += count;
+            return;
+        }
+    }
+    m_free[first] = count;
+}
+
+void TerrainArena::write(const ArenaRange &range, uint32_t offset, const Vertex *data, size_t count) {
+    if (!m_created || count == 0) return;
+    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    mp_context->glBufferSubData(GL_ARRAY_BUFFER, (range.firstVertex() + offset) * sizeof(Vertex),
+                                count * sizeof(Vertex), data);
+}
+
+void TerrainArena::bind(int pageTextureSlot, GLint dataAttribute) {
+    mp_context->glActiveTexture(GL_TEXTURE0 + pageTextureSlot);
+    mp_context->glBindTexture(GL_TEXTURE_2D, m_pageTexture);
+
+    uint32_t rows = m_pageCapacity / PAGE_ROW;
+    if (rows != m_textureRows) {
+        // Integer textures cannot be filtered
+        mp_context->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        mp_context->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        mp_context->glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32I, PAGE_ROW, rows, 0,
+                                 GL_RG_INTEGER, GL_INT, m_pageOrigins.data());
+        m_textureRows = rows;
+    } else if (m_dirtyRowsBegin < m_dirtyRowsEnd) {
+        mp_context->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, m_dirtyRowsBegin, PAGE_ROW,
+                                    m_dirtyRowsEnd - m_dirtyRowsBegin, GL_RG_INTEGER, GL_INT,
+                                    m_pageOrigins.data() + m_dirtyRowsBegin * PAGE_ROW);
+    }
+    m_dirtyRowsBegin = rows;
+    m_dirtyRowsEnd = 0;
+
+    mp_context->glBindVertexArray(m_vao);
+    if (m_vaoBuffer == m_vbo && m_vaoAttribute == dataAttribute) return;
+
+    // The element buffer binding is part of the vertex array object, and the
+    // attribute keeps the buffer bound when it was pointed at it
+    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    if (m_vaoAttribute != -1 && m_vaoAttribute != dataAttribute) {
+        mp_context->glDisableVertexAttribArray(m_vaoAttribute);
+    }
+    if (dataAttribute != -1) {
+        // Every vertex is a single packed uint, see Vertex in chunk.h
+        mp_context->glEnableVertexAttribArray(dataAttribute);
+        mp_context->glVertexAttribIPointer(dataAttribute, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void*)0);
+    }
+    m_vaoBuffer = m_vbo;
+    m_vaoAttribute = dataAttribute;
+}
+
+void TerrainArena::multiDraw(const ArenaBatch &batch) {
+    if (!m_multiDraw || batch.size() == 0) return;
+    m_multiDraw(GL_TRIANGLES, batch.counts.data(), GL_UNSIGNED_INT, batch.offsets.data(),
+                static_cast<GLsizei>(batch.size()), batch.baseVertices.data());
+}
+
+size_t TerrainArena::usedBytes() const {
+    return size_t(m_pagesUsed) * PAGE_VERTICES * sizeof(Vertex);
+}
+
+size_t TerrainArena::capacityBytes() const {
+    return size_t(m_pageCapacity) * PAGE_VERTICES * sizeof(Vertex);
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "openglcontext.h"
+#include "glm_includes.h"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+struct Vertex;
+
+// A run of pages of a TerrainArena holding one pass of one Chunk's mesh
+struct ArenaRange {
+    uint32_t firstPage = 0;
+    uint32_t pageCount = 0;
+
+    uint32_t firstVertex() const;
+    // The vertices the range has room for
+    uint32_t capacity() const;
+};
+
+// The ranges one pass draws with a single TerrainArena::multiDraw
+struct ArenaBatch {
+    std::vector<GLsizei> counts;
+    std::vector<GLint> baseVertices;
+    // Where in the shared index buffer each draw starts
+    std::vector<const void*> offsets;
+
+    void clear();
+    // Draws indexCount indices of the range, from its quad firstQuad on
+    void add(const ArenaRange &range, GLsizei indexCount, uint32_t firstQuad = 0);
+    size_t size() const;
+};
+
+// One vertex buffer holding the meshes of every uploaded Chunk, so the
+// terrain is drawn with one multi-draw per pass instead of one draw call,
+// and a rebinding of buffers and attributes, per Chunk.
+// The buffer is split into pages of PAGE_VERTICES vertices, handed out in
+// runs from a free list and grown, keeping every range where it is, when
+// none is big enough. Every quad is indexed the same way from its first
+// vertex, so all draws share one index buffer and only differ in their
+// base vertex.
+// The buffers and the vertex attribute are kept in a vertex array object
+// of the arena's own, set up again only when the buffer is replaced, so
+// drawing a pass is a bind and a draw.
+// Chunk vertices are relative to the Chunk's corner. Which Chunk a page
+// belongs to is kept in a texture, which lambert.vert.glsl looks up by
+// gl_VertexID, base vertex included, to place the vertex in the world.
+// Only used on the main thread, with the context current.
+class TerrainArena {
+public:
+    static const uint32_t PAGE_VERTICES = 256;
+    // Pages per row of the page texture
+    static const uint32_t PAGE_ROW = 1024;
+
+private:
+    typedef void (QOPENGLF_APIENTRYP MultiDrawElementsBaseVertex)(
+        GLenum mode, const GLsizei *count, GLenum type,
+        const void *const *indices, GLsizei drawcount, const GLint *basevertex);
+
+    OpenGLContext *mp_context;
+    bool m_created;
+    GLuint m_vbo;
+    GLuint m_ibo;
+    GLuint m_pageTexture;
+    GLuint m_vao;
+    // The buffer and attribute location m_vao was last set up with
+    GLuint m_vaoBuffer;
+    GLint m_vaoAttribute;
+    // Not part of OpenGL ES, so not in QOpenGLExtraFunctions
+    MultiDrawElementsBaseVertex m_multiDraw;
+
+    // The pages the vertex buffer has room for, a multiple of PAGE_ROW
+    uint32_t m_pageCapacity;
+    uint32_t m_pagesUsed;
+    // Free runs of pages, by their first page
+    std::map<uint32_t, uint32_t> m_free;
+    // The corner of the Chunk each page belongs to, mirrored in the page
+    // texture, and the rows changed since it was last brought up to date
+    std::vector<glm::ivec2> m_pageOrigins;
+    uint32_t m_dirtyRowsBegin, m_dirtyRowsEnd;
+    // The rows the page texture was last allocated with
+    uint32_t m_textureRows;
+    // The quads the shared index buffer covers
+    uint32_t m_indexQuads;
+
+    // Grows the buffer and the page texture to at least the given pages
+    void grow(uint32_t pages);
+    // Replaces the buffer with one of m_pageCapacity pages,
+    // keeping the first oldPages
+    void reallocateBuffer(uint32_t oldPages);
+    // Grows the shared index buffer to cover at least the given quads
+    void reserveIndices(uint32_t quads);
+    void uploadIndices();
+
+public:
+    explicit TerrainArena(OpenGLContext *context);
+    ~TerrainArena();
+
+    // Creates the buffers and the page texture
+    void create();
+    void destroy();
+
+    // Reserves room for the given vertices of the Chunk whose corner is
+    // at origin, growing the arena if needed. Returns an empty range
+    // for no vertices.
+    ArenaRange allocate(uint32_t vertices, glm::ivec2 origin);
+    // Returns the range's pages to the free list and empties it
+    void release(ArenaRange &range);
+    // Writes count vertices into the range, starting offset vertices in
+    void write(const ArenaRange &range, uint32_t offset, const Vertex *data, size_t count);
+
+    // Binds the arena's vertex array object, with its vertices fed to the
+    // given attribute location, and the page texture to the given slot.
+    // Leaves the vertex array object bound.
+    void bind(int pageTextureSlot, GLint dataAttribute);
+    // Draws the batch's ranges as triangles with the bound vertex array object
+    void multiDraw(const ArenaBatch &batch);
+
+    // The bytes of vertices in use, and the bytes the buffer holds
+    size_t usedBytes() const;
+    size_t capacityBytes() const;
+};
@@ -8,11 +8,11 @@
 
 ShaderProgram::ShaderProgram(OpenGLContext *context)
     : vertShader(), fragShader(), prog(),
-    attrPos(-1), attrNor(-1), attrCol(-1), attrUV(-1), attrPosOffset(-1),
+    attrPos(-1), attrNor(-1), attrCol(-1), attrUV(-1), attrPosOffset(-1), attrData(-1),
     unifModel(-1), unifModelInvTr(-1), unifViewProj(-1), unifCamPos(-1),
     unifTexture2D(-1), unifNormalMap(-1), unifTime(-1),
     unifPostType(-1), unifPostQuad(-1),
-    unifDimensions(-1), unifEye(-1),
+    unifDimensions(-1), unifEye(-1), unifPageOrigins(-1),
     context(context)
 {}
 
@@ -70,6 +70,7 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     if(attrCol == -1) attrCol = context->glGetAttribLocation(prog, "vs_ColInstanced");
     attrUV  = context->glGetAttribLocation(prog, "vs_UV");
     attrPosOffset = context->glGetAttribLocation(prog, "vs_OffsetInstanced");
+    attrData = context->glGetAttribLocation(prog, "vs_Data");
 
     unifModel      = context->glGetUniformLocation(prog, "u_Model");
     unifModelInvTr = context->glGetUniformLocation(prog, "u_ModelInvTr");
@@ -82,6 +83,7 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     unifPostQuad   = context->glGetUniformLocation(prog, "u_PostQuad");
     unifDimensions = context->glGetUniformLocation(prog, "u_Dimensions");
     unifEye        = context->glGetUniformLocation(prog, "u_Eye");
+    unifPageOrigins = context->glGetUniformLocation(prog, "u_PageOrigins");
 }
 
 void ShaderProgram::useMe()
@@ -286,8 +288,9 @@ void ShaderProgram::drawInstanced(InstancedDrawable &d)
 
 }
 
-void ShaderProgram::drawInterleavedOpaque(InterleavedDrawable& d, int textureSlot, int normalMapSlot) {
-    if (d.opaqueCount() <= 0) return;
+void ShaderProgram::drawArenaBatch(TerrainArena &arena, const ArenaBatch &batch,
+                                   int textureSlot, int normalMapSlot, int pageTextureSlot) {
+    if (batch.size() == 0) return;
 
     useMe();
 
@@ -299,69 +302,15 @@ void ShaderProgram::drawInterleavedOpaque(InterleavedDrawable& d, int textureSlo
     {
         context->glUniform1i(unifNormalMap, /*GL_TEXTURE*/normalMapSlot);
     }
-
-    // Opaque
-    if (attrPos != -1 && d.bindVboOpaque()) {
-        context->glEnableVertexAttribArray(attrPos);
-        context->glVertexAttribPointer(attrPos, 3, GL_FLOAT, false, 8 * sizeof(float), (void*)0);
-    }
-
-    if (attrNor != -1 && d.bindVboOpaque()) {
-        context->glEnableVertexAttribArray(attrNor);
-        context->glVertexAttribPointer(attrNor, 3, GL_FLOAT, false, 8 * sizeof(float), (void*)sizeof(glm::vec3));
-    }
-
-    if (attrUV != -1 && d.bindVboOpaque()) {
-        context->glEnableVertexAttribArray(attrUV);
-        context->glVertexAttribPointer(attrUV,  2, GL_FLOAT, false, 8 * sizeof(float), (void*)(2*sizeof(glm::vec3)));
-    }
-
-    d.bindIdxOpaque();
-    context->glDrawElements(d.drawMode(), d.opaqueCount(), GL_UNSIGNED_INT, 0);
-
-    if (attrPos != -1) context->glDisableVertexAttribArray(attrPos);
-    if (attrNor != -1) context->glDisableVertexAttribArray(attrNor);
-    if (attrUV  != -1) context->glDisableVertexAttribArray(attrUV);
-
-    context->printGLErrorLog();
-}
-
-void ShaderProgram::drawInterleavedTransparent(InterleavedDrawable& d, int textureSlot, int normalMapSlot) {
-    if (d.transparentCount() <= 0) return;
-
-    useMe();
-
-    if(unifTexture2D != -1)
-    {
-        context->glUniform1i(unifTexture2D, /*GL_TEXTURE*/textureSlot);
-    }
-    if(unifNormalMap != -1)
+    if(unifPageOrigins != -1)
     {
-        context->glUniform1i(unifNormalMap, /*GL_TEXTURE*/normalMapSlot);
-    }
-
-    // Transparent
-    if (attrPos != -1 && d.bindVboTransparent()) {
-        context->glEnableVertexAttribArray(attrPos);
-        context->glVertexAttribPointer(attrPos, 3, GL_FLOAT, false, 8 * sizeof(float), (void*)0);
+        context->glUniform1i(unifPageOrigins, /*GL_TEXTURE*/pageTextureSlot);
     }
 
-    if (attrNor != -1 && d.bindVboTransparent()) {
-        context->glEnableVertexAttribArray(attrNor);
-        context->glVertexAttribPointer(attrNor, 3, GL_FLOAT, false, 8 * sizeof(float), (void*)sizeof(glm::vec3));
-    }
-
-    if (attrUV != -1 && d.bindVboTransparent()) {
-        context->glEnableVertexAttribArray(attrUV);
-        context->glVertexAttribPointer(attrUV,  2, GL_FLOAT, false, 8 * sizeof(float), (void*)(2*sizeof(glm::vec3)));
-    }
-
-    d.bindIdxTransparent();
-    context->glDrawElements(d.drawMode(), d.transparentCount(), GL_UNSIGNED_INT, 0);
-
-    if (attrPos != -1) context->glDisableVertexAttribArray(attrPos);
-    if (attrNor != -1) context->glDisableVertexAttribArray(attrNor);
-    if (attrUV  != -1) context->glDisableVertexAttribArray(attrUV);
+    // One buffer and one attribute for every Chunk in the batch,
+    // set up in the arena's vertex array object
+    arena.bind(pageTextureSlot, attrData);
+    arena.multiDraw(batch);
 
     context->printGLErrorLog();
 }
@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 
 #include "drawable.h"
+#include "scene/terrainarena.h"
 
 
 class ShaderProgram
@@ -20,6 +21,7 @@ public:
     int attrCol; // A handle for the "in" vec4 representing vertex color in the vertex shader
     int attrUV; // A handle for the "in" vec2 representing the UV coordinates in the vertex shader
     int attrPosOffset; // A handle for a vec3 used only in the instanced rendering shader
+    int attrData; // A handle for the "in" uint holding a packed chunk vertex
 
     int unifModel; // A handle for the "uniform" mat4 representing model matrix in the vertex shader
     int unifModelInvTr; // A handle for the "uniform" mat4 representing inverse transpose of the model matrix in the vertex shader
@@ -32,6 +34,7 @@ public:
     int unifPostQuad; // The post effected quad
     int unifDimensions; // The dimensions of the screen
     int unifEye; // The position of the eye
+    int unifPageOrigins; // A handle for the "uniform" isampler2D holding the corner of the Chunk each page of the TerrainArena belongs to
 
 public:
     ShaderProgram(OpenGLContext* context);
@@ -57,10 +60,9 @@ public:
     void draw(Drawable &d);
     // Draw the given object to our screen multiple times using instanced rendering
     void drawInstanced(InstancedDrawable &d);
-    // Draw the given object to our screen using interleaved vbo
-    void drawInterleavedOpaque(InterleavedDrawable &d, int textureSlot = 0, int normalMapSlot = 1);
-    // Draw the given object to our screen using interleaved vbo
-    void drawInterleavedTransparent(InterleavedDrawable &d, int textureSlot = 0, int normalMapSlot = 1);
+    // Draw the batch's Chunk meshes out of the arena with a single multi-draw
+    void drawArenaBatch(TerrainArena &arena, const ArenaBatch &batch,
+                        int textureSlot = 0, int normalMapSlot = 1, int pageTextureSlot = 3);
     // Draw the post effected image to screen
     void drawPostEffected(Drawable &d);
     // Utility function used in create()
@@ -1,49 +1,18 @@
-INCLUDEPATH += $$PWD
-DEPENDPATH += $$PWD
+include($$PWD/core.pri)
 
 SOURCES += \
-    $$PWD/biome.cpp \
     $$PWD/framebuffer.cpp \
     $$PWD/main.cpp \
     $$PWD/mainwindow.cpp \
     $$PWD/mygl.cpp \
     $$PWD/quad.cpp \
-    $$PWD/scene/FBMWorker.cpp \
-    $$PWD/scene/VBOWorker.cpp \
-    $$PWD/shaderprogram.cpp \
-    $$PWD/drawable.cpp \
     $$PWD/cameracontrolshelp.cpp \
-    $$PWD/scene/cube.cpp \
-    $$PWD/openglcontext.cpp \
-    $$PWD/scene/terrain.cpp \
-    $$PWD/scene/worldaxes.cpp \
-    $$PWD/scene/entity.cpp \
-    $$PWD/scene/player.cpp \
-    $$PWD/scene/camera.cpp \
-    $$PWD/playerinfo.cpp \
-    $$PWD/scene/chunk.cpp \
-    $$PWD/texture.cpp
+    $$PWD/playerinfo.cpp
 
 HEADERS += \
-    $$PWD/biome.h \
     $$PWD/framebuffer.h \
     $$PWD/mainwindow.h \
     $$PWD/mygl.h \
     $$PWD/quad.h \
-    $$PWD/shaderprogram.h \
-    $$PWD/drawable.h \
     $$PWD/cameracontrolshelp.h \
-    $$PWD/scene/cube.h \
-    $$PWD/openglcontext.h \
-    $$PWD/scene/terrain.h \
-    $$PWD/scene/worldaxes.h \
-    $$PWD/smartpointerhelp.h \
-    $$PWD/glm_includes.h \
-    $$PWD/scene/entity.h \
-    $$PWD/scene/player.h \
-    $$PWD/scene/camera.h \
-    $$PWD/playerinfo.h \
-    $$PWD/scene/chunk.h \
-    $$PWD/scene/FBMWorker.h \
-    $$PWD/scene/VBOWorker.h \
-    $$PWD/texture.h
+    $$PWD/playerinfo.h